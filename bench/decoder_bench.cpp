@@ -0,0 +1,151 @@
+// Chunk decompression with the reused per-thread ChunkDecoder against the per-chunk setup it replaced.
+//
+//   decoder_bench [chunks] [chunk size] [compression level]
+//
+// Compresses `chunks` (default 2000) synthetic chunks of `chunk size` bytes (default 64K, K/M suffixes
+// accepted) with zlib and with zstd, then decodes all of them on one thread both ways. Small chunks show the
+// cost of creating a decoder and its buffers for every chunk. Each scenario prints the best of five rounds.
+
+#include "chunk_decoder.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Chunk = std::vector<uint8_t>;
+
+// The decoding every extraction worker did before ChunkDecoder: a fresh inflate stream or ZSTD_DStream and a
+// fresh output buffer for every chunk, always streamed.
+void decode_per_chunk(const std::string& compression, const uint8_t* data, size_t size, const ChunkSink& sink) {
+    if (compression == "zlib") {
+        z_stream strm = {};
+        if (inflateInit(&strm) != Z_OK) throw std::runtime_error("inflateInit failed");
+        std::vector<char> out_buffer(1024 * 1024);
+        strm.next_in = const_cast<Bytef*>(data);
+        strm.avail_in = static_cast<uInt>(size);
+        for (;;) {
+            strm.avail_out = static_cast<uInt>(out_buffer.size());
+            strm.next_out = reinterpret_cast<Bytef*>(out_buffer.data());
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                inflateEnd(&strm);
+                throw std::runtime_error("zlib stream error");
+            }
+            size_t have = out_buffer.size() - strm.avail_out;
+            if (have > 0) sink(out_buffer.data(), have);
+            if (ret == Z_STREAM_END) break;
+        }
+        inflateEnd(&strm);
+    } else {
+        ZSTD_DStream* dstream = ZSTD_createDStream();
+        if (dstream == nullptr) throw std::runtime_error("ZSTD_createDStream() failed");
+        std::vector<char> out_buffer(ZSTD_DStreamOutSize());
+        ZSTD_inBuffer input = { data, size, 0 };
+        for (;;) {
+            ZSTD_outBuffer output = { out_buffer.data(), out_buffer.size(), 0 };
+            size_t ret = ZSTD_decompressStream(dstream, &output, &input);
+            if (ZSTD_isError(ret)) {
+                ZSTD_freeDStream(dstream);
+                throw std::runtime_error("ZSTD decompress error: " + std::string(ZSTD_getErrorName(ret)));
+            }
+            if (output.pos > 0) sink(out_buffer.data(), output.pos);
+            if (input.pos == input.size && output.pos < output.size) break;
+        }
+        ZSTD_freeDStream(dstream);
+    }
+}
+
+// Partly compressible data, roughly like a file system image: runs of zeros between pseudo-random bytes.
+Chunk make_chunk(size_t size, uint64_t seed) {
+    Chunk chunk(size);
+    uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (size_t i = 0; i < size; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        chunk[i] = (i / 512) % 3 == 0 ? 0 : static_cast<uint8_t>((x >> 56) & 0x3f);
+    }
+    return chunk;
+}
+
+Chunk compress_chunk(const std::string& compression, const Chunk& raw, int level) {
+    Chunk out;
+    if (compression == "zlib") {
+        uLongf out_size = compressBound(static_cast<uLong>(raw.size()));
+        out.resize(out_size);
+        if (compress2(out.data(), &out_size, raw.data(), static_cast<uLong>(raw.size()), level) != Z_OK)
+            throw std::runtime_error("compress2 failed");
+        out.resize(out_size);
+    } else {
+        out.resize(ZSTD_compressBound(raw.size()));
+        size_t ret = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), level);
+        if (ZSTD_isError(ret)) throw std::runtime_error("ZSTD_compress failed");
+        out.resize(ret);
+    }
+    return out;
+}
+
+template<class Round>
+void report(const char* name, size_t bytes, Round round) {
+    double best = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        round();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    std::printf("%-28s %10.3f ms %10.1f MiB/s\n", name, best * 1e3, bytes / 1048576.0 / best);
+}
+
+size_t parse_size(const char* text) {
+    char* end = nullptr;
+    size_t value = std::strtoul(text, &end, 10);
+    if (*end == 'K' || *end == 'k') value *= 1024;
+    else if (*end == 'M' || *end == 'm') value *= 1024 * 1024;
+    return value;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t chunks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t chunk_size = argc > 2 ? parse_size(argv[2]) : 64 * 1024;
+    int level = argc > 3 ? std::atoi(argv[3]) : 1;
+    if (chunks == 0) chunks = 1;
+    if (chunk_size == 0) chunk_size = 1;
+    std::printf("%zu chunks of %zu bytes, compression level %d\n", chunks, chunk_size, level);
+
+    // A sink that reads the output, as the image writers do, without the cost of writing it anywhere.
+    uint64_t checksum = 0;
+    ChunkSink sink = [&checksum](const char* data, size_t size) { checksum += static_cast<uint8_t>(data[size - 1]); };
+
+    try {
+        for (const std::string compression : {"zlib", "zstd"}) {
+            std::vector<Chunk> compressed;
+            size_t raw_bytes = 0;
+            for (size_t i = 0; i < chunks; ++i) {
+                Chunk raw = make_chunk(chunk_size, i);
+                raw_bytes += raw.size();
+                compressed.push_back(compress_chunk(compression, raw, level));
+            }
+
+            const std::string per_chunk = compression + ", per-chunk setup";
+            const std::string reused = compression + ", reused ChunkDecoder";
+            report(per_chunk.c_str(), raw_bytes, [&] {
+                for (const Chunk& chunk : compressed) decode_per_chunk(compression, chunk.data(), chunk.size(), sink);
+            });
+            report(reused.c_str(), raw_bytes, [&] {
+                ChunkDecoder& decoder = ChunkDecoder::for_this_thread();
+                for (const Chunk& chunk : compressed)
+                    decoder.decompress(compression, chunk.data(), chunk.size(), chunk_size, sink);
+            });
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    std::printf("(checksum %llu)\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
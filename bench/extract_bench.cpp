@@ -0,0 +1,118 @@
+// Scaling of DZ partition extraction with the number of compute threads.
+//
+//   extract_bench <firmware.kdz> [scratch dir] [max threads] [rounds]
+//
+// Extracts every partition of the KDZ into the scratch directory with 1, 2, 4, ... compute threads up to
+// `max threads` (default: every available CPU), and prints the best of `rounds` (default 3) for each count.
+// The scratch directory (default: next to the KDZ) must not exist yet and is removed afterwards. The KDZ is
+// mapped once and the DZ is faulted into the page cache before the first round; extraction leaves it cached,
+// so the numbers show how the decompressors and the positional image writes scale rather than how fast the
+// disk reads.
+
+#include "dz_parser.hpp"
+#include "executors.hpp"
+#include "extractor.hpp"
+#include "kdz_parser.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Sends std::cout to nowhere while the extractor reports its progress.
+class QuietCout {
+public:
+    QuietCout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~QuietCout() { std::cout.rdbuf(saved); }
+
+private:
+    std::ostringstream sink;
+    std::streambuf* saved;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <firmware.kdz> [scratch dir] [max threads] [rounds]\n", argv[0]);
+        return 1;
+    }
+    const std::string kdz_path = argv[1];
+    const fs::path scratch = argc > 2 ? fs::path(argv[2]) : fs::path(kdz_path + ".extract_bench");
+    size_t max_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : available_cpus();
+    int rounds = argc > 4 ? std::atoi(argv[4]) : 3;
+    if (max_threads == 0) max_threads = 1;
+    if (rounds <= 0) rounds = 1;
+    if (fs::exists(scratch)) {
+        std::fprintf(stderr, "Error: scratch directory %s already exists\n", scratch.string().c_str());
+        return 1;
+    }
+
+    try {
+        std::ifstream in_file(kdz_path, std::ios::binary);
+        if (!in_file) throw std::runtime_error("Cannot open file " + kdz_path);
+        MappedFile kdz_map(kdz_path);
+        KdzHeader kdz_header(in_file);
+
+        const KdzHeader::Record* dz_record = nullptr;
+        for (const auto& record : kdz_header.records) {
+            if (record.name.size() >= 3 && record.name.substr(record.name.size() - 3) == ".dz") {
+                dz_record = &record;
+                break;
+            }
+        }
+        if (!dz_record) throw std::runtime_error("No DZ record in KDZ file");
+        DzHeader dz_hdr(kdz_map, *dz_record, true);
+        kdz_map.prefetch(dz_record->offset, dz_hdr.dz_size());
+
+        uint64_t image_bytes = 0;
+        for (const auto& hw : dz_hdr.parts)
+            for (const auto& part : hw.second)
+                for (const auto& chunk : part.second) image_bytes += chunk.data_size;
+
+        std::printf("%s: %.1f MiB of compressed chunks, %.1f MiB of image data (%s), best of %d\n",
+                    kdz_path.c_str(), dz_hdr.dz_size() / 1048576.0, image_bytes / 1048576.0,
+                    dz_hdr.compression.c_str(), rounds);
+        std::printf("%8s %12s %12s %9s\n", "threads", "time", "MiB/s", "speedup");
+
+        std::vector<size_t> counts;
+        for (size_t threads = 1; threads < max_threads; threads *= 2) counts.push_back(threads);
+        counts.push_back(max_threads);
+
+        double single_thread = 0;
+        for (size_t threads : counts) {
+            Executors executors(threads, 0);
+            ExtractOptions options;
+            double best = 1e300;
+            for (int r = 0; r < rounds; ++r) {
+                fs::remove_all(scratch);
+                fs::create_directories(scratch);
+                auto start = std::chrono::steady_clock::now();
+                {
+                    QuietCout quiet;
+                    extract_dz_parts(kdz_map, dz_hdr, scratch.string(), executors, options);
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (seconds < best) best = seconds;
+            }
+            if (threads == 1) single_thread = best;
+            std::printf("%8zu %9.3f ms %12.1f %8.2fx\n", threads, best * 1e3, image_bytes / 1048576.0 / best,
+                        single_thread / best);
+        }
+        fs::remove_all(scratch);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        fs::remove_all(scratch);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Task throughput of ThreadPool against the single-mutex pool it replaced.
+//
+//   thread_pool_bench [threads] [tasks] [work]
+//
+// Every task spins for `work` iterations, so a small value measures scheduling overhead and a large one
+// shows that the pools keep up with real chunk work. Each scenario prints the best of five rounds.
+
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <string>
+
+namespace {
+
+// The previous ThreadPool: one std::queue of std::function behind one mutex and condition variable.
+class MutexThreadPool {
+public:
+    explicit MutexThreadPool(size_t threads) {
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            });
+    }
+
+    template<class F>
+    std::future<void> enqueue(F&& f) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::forward<F>(f));
+        std::future<void> res = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        condition.notify_one();
+        return res;
+    }
+
+    ~MutexThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop = false;
+};
+
+std::atomic<uint64_t> sink{0};
+
+void spin(size_t work) {
+    uint64_t x = work;
+    for (size_t i = 0; i < work; ++i) x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    sink.fetch_add(x, std::memory_order_relaxed);
+}
+
+template<class Round>
+void report(const char* name, size_t tasks, Round round) {
+    double best = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        round();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    std::printf("%-28s %10.3f ms %12.0f tasks/s\n", name, best * 1e3, tasks / best);
+}
+
+template<class Pool>
+void enqueue_round(Pool& pool, size_t tasks, size_t work) {
+    std::vector<std::future<void>> results;
+    results.reserve(tasks);
+    for (size_t i = 0; i < tasks; ++i) results.push_back(pool.enqueue([work] { spin(work); }));
+    for (auto& result : results) result.get();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+    size_t tasks = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    size_t work = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100;
+    if (threads == 0) threads = 1;
+    if (tasks == 0) tasks = 1;
+    std::printf("%zu threads, %zu tasks, %zu iterations per task\n", threads, tasks, work);
+
+    {
+        MutexThreadPool pool(threads);
+        report("mutex pool, enqueue", tasks, [&] { enqueue_round(pool, tasks, work); });
+    }
+    {
+        ThreadPool pool(threads);
+        report("work-stealing, enqueue", tasks, [&] { enqueue_round(pool, tasks, work); });
+        report("work-stealing, submit_bulk", tasks, [&] {
+            pool.submit_bulk(tasks, [work](size_t) { spin(work); }).wait();
+        });
+        // Tasks that fan out from inside the pool land on the submitting worker's own deque.
+        report("work-stealing, nested", tasks, [&] {
+            // The last inner task may still be inside set_value when the wait below returns, so the counter
+            // and the promise live as long as the tasks that hold them rather than on this stack.
+            struct Round {
+                std::atomic<size_t> remaining;
+                std::promise<void> all_done;
+            };
+            auto round = std::make_shared<Round>();
+            round->remaining = tasks;
+            std::future<void> all_done = round->all_done.get_future();
+            const size_t outer = std::min(threads * 4, tasks);
+            pool.submit_bulk(outer, [&pool, round, outer, tasks, work](size_t o) {
+                size_t count = tasks / outer + (o < tasks % outer ? 1 : 0);
+                for (size_t i = 0; i < count; ++i) {
+                    pool.enqueue([round, work] {
+                        spin(work);
+                        if (round->remaining.fetch_sub(1) == 1) round->all_done.set_value();
+                    });
+                }
+            });
+            all_done.wait();
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "chunk_cache.hpp"
+#include <sha256.hpp>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t CHUNK_CACHE_MAGIC = 0x4843434b; // "KCCH"
+constexpr uint32_t CHUNK_CACHE_VERSION = 1;
+
+#pragma pack(push, 1)
+struct ChunkCacheEntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t raw_size;
+    uint32_t compressed_size;
+    uint8_t md5[16];
+    // CRC32 of the compressed data that follows; also the chunk header's crc field.
+    uint32_t crc;
+};
+#pragma pack(pop)
+
+ChunkCache::ChunkCache(const fs::path& dir, uint64_t max_bytes) : cache_dir(dir), max_bytes(max_bytes) {
+    fs::create_directories(cache_dir);
+}
+
+std::string ChunkCache::key_for(const CodecParams& codec, const char* data, size_t size) {
+    Sha256 hasher;
+    std::string codec_desc = codec.describe();
+    hasher.update(codec_desc.data(), codec_desc.size() + 1);
+    uint64_t size64 = size;
+    hasher.update(&size64, sizeof(size64));
+    hasher.update(data, size);
+    return hasher.hexdigest();
+}
+
+fs::path ChunkCache::entry_path(const std::string& key) const {
+    return cache_dir / key.substr(0, 2) / (key + ".chunk");
+}
+
+bool ChunkCache::load(const std::string& key, size_t raw_size, CompressedChunk& chunk) {
+    fs::path path = entry_path(key);
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        ++miss_count;
+        return false;
+    }
+
+    ChunkCacheEntryHeader hdr;
+    in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+    // The size check comes before the allocation, so a damaged header cannot ask for gigabytes.
+    std::error_code ec;
+    uint64_t file_size = fs::file_size(path, ec);
+    if (!in || hdr.magic != CHUNK_CACHE_MAGIC || hdr.version != CHUNK_CACHE_VERSION || hdr.raw_size != raw_size ||
+        ec || file_size != sizeof(hdr) + uint64_t(hdr.compressed_size)) {
+        ++miss_count;
+        return false;
+    }
+    chunk.data.resize(hdr.compressed_size);
+    in.read(chunk.data.data(), chunk.data.size());
+    if (!in || crc32(0L, reinterpret_cast<const Bytef*>(chunk.data.data()), static_cast<uInt>(chunk.data.size())) != hdr.crc) {
+        ++miss_count;
+        return false;
+    }
+    chunk.md5.assign(hdr.md5, hdr.md5 + sizeof(hdr.md5));
+    chunk.crc = hdr.crc;
+
+    // The mtime is the LRU clock. Another process may have evicted the entry meanwhile, which is harmless.
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    ++hit_count;
+    return true;
+}
+
+void ChunkCache::store(const std::string& key, size_t raw_size, const CompressedChunk& chunk) {
+    ChunkCacheEntryHeader hdr = {};
+    hdr.magic = CHUNK_CACHE_MAGIC;
+    hdr.version = CHUNK_CACHE_VERSION;
+    hdr.raw_size = raw_size;
+    hdr.compressed_size = static_cast<uint32_t>(chunk.data.size());
+    std::memcpy(hdr.md5, chunk.md5.data(), sizeof(hdr.md5));
+    hdr.crc = chunk.crc;
+
+    // The temporary name is unique per thread and process, so concurrent writers of the same key never
+    // share a file; the last rename wins and both wrote identical content.
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    fs::path path = entry_path(key);
+    fs::path tmp_path = path;
+    tmp_path += "." + std::to_string(rng()) + ".tmp";
+
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        out.write(chunk.data.data(), chunk.data.size());
+        if (!out) {
+            out.close();
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) fs::remove(tmp_path, ec);
+}
+
+void ChunkCache::trim() {
+    if (max_bytes == 0) return;
+
+    struct Entry {
+        fs::file_time_type mtime;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    const auto stale_tmp = fs::file_time_type::clock::now() - std::chrono::hours(1);
+
+    // Entries can disappear while the directory is scanned, when another process trims at the same time.
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(cache_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        Entry entry{it->last_write_time(ec), it->file_size(ec), it->path()};
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+        if (entry.path.extension() == ".tmp") {
+            // Left behind by a writer that was killed
+            if (entry.mtime < stale_tmp) fs::remove(entry.path, ec);
+            ec.clear();
+            continue;
+        }
+        if (entry.path.extension() != ".chunk") continue;
+        total += entry.size;
+        entries.push_back(std::move(entry));
+    }
+    if (total <= max_bytes) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+    for (const auto& entry : entries) {
+        if (total <= max_bytes) break;
+        fs::remove(entry.path, ec);
+        total -= entry.size;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CHUNK_CACHE_HPP
+#define CHUNK_CACHE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <filesystem>
+#include "chunk_encoder.hpp"
+
+// A compressed DZ chunk with the MD5 and CRC32 of its compressed bytes, as the chunk header stores them.
+struct CompressedChunk {
+    std::vector<char> data;
+    std::vector<char> md5;
+    uint32_t crc = 0;
+};
+
+// On-disk cache of compressed chunks shared by repack runs, and by kdz-tool processes running at the same
+// time. Entries are content addressed: the key is the SHA-256 of the codec settings, the raw chunk size and the
+// raw chunk data. Each entry is its own file (<dir>/<xx>/<key>.chunk), written under a temporary name
+// and renamed into place, so readers only ever see complete entries and no lock is needed.
+// A hit refreshes the entry's mtime; trim() evicts the least recently used entries beyond the size limit.
+class ChunkCache {
+public:
+    // Creates `dir` if needed. A `max_bytes` of 0 means no size limit.
+    ChunkCache(const std::filesystem::path& dir, uint64_t max_bytes);
+
+    static std::string key_for(const CodecParams& codec, const char* data, size_t size);
+
+    // Fills `chunk` from the entry for `key`. Returns false if there is none or it is damaged.
+    bool load(const std::string& key, size_t raw_size, CompressedChunk& chunk);
+    // Adds an entry. Failures are not fatal: the chunk is simply not cached.
+    void store(const std::string& key, size_t raw_size, const CompressedChunk& chunk);
+    // Deletes the least recently used entries until the cache fits in its size limit.
+    void trim();
+
+    const std::filesystem::path& dir() const { return cache_dir; }
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+private:
+    std::filesystem::path entry_path(const std::string& key) const;
+
+    std::filesystem::path cache_dir;
+    uint64_t max_bytes;
+    std::atomic<size_t> hit_count{0};
+    std::atomic<size_t> miss_count{0};
+};
+
+#endif // CHUNK_CACHE_HPP
@@ -0,0 +1,110 @@
+#include "chunk_decoder.hpp"
+#include <stdexcept>
+
+ChunkDecoder::ChunkDecoder() : strm() {}
+
+ChunkDecoder::~ChunkDecoder() {
+    if (strm_ready) inflateEnd(&strm);
+    if (dctx != nullptr) ZSTD_freeDCtx(dctx);
+}
+
+ChunkDecoder& ChunkDecoder::for_this_thread() {
+    thread_local ChunkDecoder decoder;
+    return decoder;
+}
+
+void ChunkDecoder::decompress(const std::string& compression, const uint8_t* data, size_t size,
+                              uint64_t expected_size, const ChunkSink& sink, const StopToken* stop) {
+    // One shot when the decompressed size is known and reasonable, otherwise stream.
+    bool one_shot = expected_size > 0 && expected_size <= ONE_SHOT_LIMIT;
+    size_t out_size = one_shot ? static_cast<size_t>(expected_size) : STREAM_BUFFER_SIZE;
+    // The buffer only ever grows, up to ONE_SHOT_LIMIT, so steady state runs without allocations.
+    if (buffer.size() < out_size) buffer.resize(out_size);
+
+    if (compression == "zlib") {
+        inflate_chunk(data, size, out_size, sink, stop);
+    } else if (compression == "zstd") {
+        zstd_chunk(data, size, out_size, one_shot, sink, stop);
+    } else {
+        throw std::runtime_error("Unknown compression type: " + compression);
+    }
+}
+
+void ChunkDecoder::inflate_chunk(const uint8_t* data, size_t size, size_t out_size, const ChunkSink& sink,
+                                 const StopToken* stop) {
+    if (!strm_ready) {
+        if (inflateInit(&strm) != Z_OK) throw std::runtime_error("inflateInit failed in worker thread");
+        strm_ready = true;
+    } else if (inflateReset(&strm) != Z_OK) {
+        throw std::runtime_error("inflateReset failed in worker thread");
+    }
+
+    // The whole compressed chunk is fed at once.
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.avail_in = static_cast<uInt>(size);
+
+    for (;;) {
+        strm.avail_out = static_cast<uInt>(out_size);
+        strm.next_out = reinterpret_cast<Bytef*>(buffer.data());
+
+        // Z_FINISH lets inflate decode straight into the buffer when it is big enough for the whole chunk.
+        int ret = inflate(&strm, Z_FINISH);
+        if (ret != Z_STREAM_END && ret != Z_OK && ret != Z_BUF_ERROR) {
+            throw std::runtime_error("zlib stream error in worker thread");
+        }
+        // Short of the stream end with room left in the buffer means the input ran out.
+        if (ret != Z_STREAM_END && strm.avail_out != 0) {
+            throw std::runtime_error("zlib stream truncated in worker thread");
+        }
+
+        size_t have = out_size - strm.avail_out;
+        if (have > 0) sink(buffer.data(), have);
+        if (ret == Z_STREAM_END) break;
+        if (stop) stop->throw_if_stopped();
+    }
+}
+
+void ChunkDecoder::zstd_chunk(const uint8_t* data, size_t size, size_t out_size, bool one_shot,
+                              const ChunkSink& sink, const StopToken* stop) {
+    if (dctx == nullptr) {
+        dctx = ZSTD_createDCtx();
+        if (dctx == nullptr) throw std::runtime_error("ZSTD_createDCtx() failed in worker thread");
+        // Repack can raise the window log above the streaming decoder's default limit.
+        ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound);
+    }
+
+    if (one_shot) {
+        size_t ret = ZSTD_decompressDCtx(dctx, buffer.data(), out_size, data, size);
+        if (!ZSTD_isError(ret)) {
+            if (ret > 0) sink(buffer.data(), ret);
+            return;
+        }
+        // A chunk larger than its recorded data_size still decodes, just streamed.
+        if (ZSTD_getErrorCode(ret) != ZSTD_error_dstSize_tooSmall) {
+            throw std::runtime_error("ZSTD decompress error in worker thread: " + std::string(ZSTD_getErrorName(ret)));
+        }
+    }
+
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    ZSTD_inBuffer input = { data, size, 0 };
+    // What ZSTD_decompressStream last returned while making progress: 0 once a frame is complete. A call after
+    // the end of a frame returns the header size of a next frame instead, so calls that did nothing don't count.
+    size_t frame_remaining = 1;
+    for (;;) {
+        ZSTD_outBuffer output = { buffer.data(), out_size, 0 };
+        size_t consumed = input.pos;
+        size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error("ZSTD decompress error in worker thread: " + std::string(ZSTD_getErrorName(ret)));
+        }
+        if (input.pos != consumed || output.pos > 0) frame_remaining = ret;
+
+        if (output.pos > 0) sink(buffer.data(), output.pos);
+        // Done once all input is consumed and the decoder has nothing left to flush.
+        if (input.pos == input.size && output.pos < output.size) {
+            if (frame_remaining != 0) throw std::runtime_error("ZSTD stream truncated in worker thread");
+            break;
+        }
+        if (stop) stop->throw_if_stopped();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef CHUNK_DECODER_HPP
+#define CHUNK_DECODER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+#include <zlib.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+#include "stop_token.hpp"
+
+// Receives decompressed data in order, one output buffer at a time.
+using ChunkSink = std::function<void(const char* data, size_t size)>;
+
+// Decompression state that persists across chunks: one inflate stream (reset with inflateReset),
+// one ZSTD_DCtx and one output buffer. Each worker thread owns its own instance.
+class ChunkDecoder {
+public:
+    ChunkDecoder();
+    ~ChunkDecoder();
+
+    ChunkDecoder(const ChunkDecoder&) = delete;
+    ChunkDecoder& operator=(const ChunkDecoder&) = delete;
+
+    // Returns the decoder belonging to the calling thread.
+    static ChunkDecoder& for_this_thread();
+
+    // Decompresses `size` bytes of `compression` ("zlib" or "zstd") data and streams the result to `sink`.
+    // `expected_size` is the chunk's data_size; when it fits in ONE_SHOT_LIMIT the whole chunk is decoded
+    // in one call into the reused buffer and handed to `sink` at once. A streamed chunk checks `stop` after
+    // every buffer and throws OperationCancelled once it is triggered.
+    void decompress(const std::string& compression, const uint8_t* data, size_t size,
+                    uint64_t expected_size, const ChunkSink& sink, const StopToken* stop = nullptr);
+
+    // Largest chunk decoded in one shot; bigger ones are streamed through STREAM_BUFFER_SIZE. It also bounds
+    // the buffer every worker thread keeps for its lifetime.
+    static constexpr size_t ONE_SHOT_LIMIT = 4 * 1024 * 1024;
+    static constexpr size_t STREAM_BUFFER_SIZE = 1024 * 1024;
+
+private:
+    void inflate_chunk(const uint8_t* data, size_t size, size_t out_size, const ChunkSink& sink, const StopToken* stop);
+    void zstd_chunk(const uint8_t* data, size_t size, size_t out_size, bool one_shot, const ChunkSink& sink,
+                    const StopToken* stop);
+
+    z_stream strm;
+    bool strm_ready = false;
+    ZSTD_DCtx* dctx = nullptr;
+    std::vector<char> buffer;
+};
+
+#endif // CHUNK_DECODER_HPP
@@ -0,0 +1,220 @@
+#include "chunk_encoder.hpp"
+#include <stdexcept>
+
+static const char* const ZSTD_STRATEGY_NAMES[] = {
+    "fast", "dfast", "greedy", "lazy", "lazy2", "btlazy2", "btopt", "btultra", "btultra2"
+};
+
+int CodecParams::zstd_strategy_from_name(const std::string& name) {
+    for (int i = 0; i < 9; ++i) {
+        if (name == ZSTD_STRATEGY_NAMES[i]) return i + 1;
+    }
+    throw std::runtime_error("Unknown zstd strategy '" + name + "'");
+}
+
+std::string CodecParams::zstd_strategy_name(int strategy) {
+    if (strategy < 1 || strategy > 9) throw std::runtime_error("Invalid zstd strategy " + std::to_string(strategy));
+    return ZSTD_STRATEGY_NAMES[strategy - 1];
+}
+
+CodecParams CodecParams::from_metadata(const json& dz_meta) {
+    CodecParams params;
+    params.compression = dz_meta["compression"].get<std::string>();
+
+    if (dz_meta.contains("codec")) {
+        const json& codec = dz_meta["codec"];
+        if (codec.contains("level")) params.level = codec["level"].get<int>();
+        params.zstd_long = codec.value("zstd_long", false);
+        params.zstd_window_log = codec.value("zstd_window_log", 0);
+        if (codec.contains("zstd_strategy")) {
+            params.zstd_strategy = zstd_strategy_from_name(codec["zstd_strategy"].get<std::string>());
+        }
+        params.zlib_block_size = codec.value("zlib_block_size", 0u);
+    }
+    params.validate();
+    return params;
+}
+
+json CodecParams::to_json() const {
+    json codec = json::object();
+    if (level.has_value()) codec["level"] = *level;
+    if (zstd_long) codec["zstd_long"] = true;
+    if (zstd_window_log != 0) codec["zstd_window_log"] = zstd_window_log;
+    if (zstd_strategy != 0) codec["zstd_strategy"] = zstd_strategy_name(zstd_strategy);
+    if (zlib_block_size != 0) codec["zlib_block_size"] = zlib_block_size;
+    return codec;
+}
+
+void CodecParams::validate() const {
+    if (compression == "zlib") {
+        if (level.has_value() && (*level < Z_DEFAULT_COMPRESSION || *level > Z_BEST_COMPRESSION)) {
+            throw std::runtime_error("zlib level must be -1 (default) to 9, got " + std::to_string(*level));
+        }
+        if (zstd_long || zstd_window_log != 0 || zstd_strategy != 0) {
+            throw std::runtime_error("zstd parameters given, but the DZ uses zlib compression");
+        }
+        // Each block is primed with the 32K window before it, so smaller blocks would mostly be dictionary.
+        if (zlib_block_size != 0 && zlib_block_size < 64 * 1024) {
+            throw std::runtime_error("zlib block size must be at least 64K, got " + std::to_string(zlib_block_size));
+        }
+    } else if (compression == "zstd") {
+        if (level.has_value() && (*level < ZSTD_minCLevel() || *level > ZSTD_maxCLevel())) {
+            throw std::runtime_error("zstd level must be between " + std::to_string(ZSTD_minCLevel()) + " and " +
+                                     std::to_string(ZSTD_maxCLevel()) + ", got " + std::to_string(*level));
+        }
+        ZSTD_bounds window = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+        if (zstd_window_log != 0 && (zstd_window_log < window.lowerBound || zstd_window_log > window.upperBound)) {
+            throw std::runtime_error("zstd window log must be between " + std::to_string(window.lowerBound) + " and " +
+                                     std::to_string(window.upperBound) + ", got " + std::to_string(zstd_window_log));
+        }
+        if (zstd_strategy != 0) zstd_strategy_name(zstd_strategy);
+        if (zlib_block_size != 0) {
+            throw std::runtime_error("zlib block size given, but the DZ uses zstd compression");
+        }
+    } else {
+        throw std::runtime_error("Unknown compression type: " + compression);
+    }
+}
+
+std::string CodecParams::describe() const {
+    std::string s = compression + ", level " + (level.has_value() ? std::to_string(*level) : "default");
+    if (zstd_long) s += ", long distance matching";
+    if (zstd_window_log != 0) s += ", window log " + std::to_string(zstd_window_log);
+    if (zstd_strategy != 0) s += ", strategy " + zstd_strategy_name(zstd_strategy);
+    if (zlib_block_size != 0) s += ", parallel blocks of " + std::to_string(zlib_block_size) + " bytes";
+    return s;
+}
+
+bool CodecParams::operator==(const CodecParams& other) const {
+    return compression == other.compression && level == other.level && zstd_long == other.zstd_long &&
+           zstd_window_log == other.zstd_window_log && zstd_strategy == other.zstd_strategy && zlib_block_size == other.zlib_block_size;
+}
+
+std::vector<char> zlib_stream_header(int level) {
+    // CMF: deflate with a 32K window. FLG: the level class deflate reports, padded to a multiple of 31.
+    int level_class = 2;
+    if (level == 0 || level == 1) level_class = 0;
+    else if (level >= 2 && level <= 5) level_class = 1;
+    else if (level >= 7) level_class = 3;
+    unsigned header = (0x78u << 8) | (static_cast<unsigned>(level_class) << 6);
+    header += 31 - header % 31;
+    return {static_cast<char>(header >> 8), static_cast<char>(header & 0xff)};
+}
+
+ChunkEncoder::ChunkEncoder() : strm(), raw_strm() {}
+
+ChunkEncoder::~ChunkEncoder() {
+    if (strm_ready) deflateEnd(&strm);
+    if (raw_strm_ready) deflateEnd(&raw_strm);
+    if (cctx != nullptr) ZSTD_freeCCtx(cctx);
+}
+
+ChunkEncoder& ChunkEncoder::for_this_thread() {
+    thread_local ChunkEncoder encoder;
+    return encoder;
+}
+
+void ChunkEncoder::compress(const CodecParams& params, const char* data, size_t size, std::vector<char>& output) {
+    if (params.compression == "zlib") {
+        deflate_chunk(params, data, size, output);
+    } else if (params.compression == "zstd") {
+        zstd_chunk(params, data, size, output);
+    } else {
+        throw std::runtime_error("Unknown compression type: " + params.compression);
+    }
+}
+
+void ChunkEncoder::deflate_chunk(const CodecParams& params, const char* data, size_t size, std::vector<char>& output) {
+    int level = params.level.value_or(Z_DEFAULT_COMPRESSION);
+    if (strm_ready && strm_level != level) {
+        deflateEnd(&strm);
+        strm_ready = false;
+    }
+    if (!strm_ready) {
+        strm = z_stream();
+        if (deflateInit(&strm, level) != Z_OK) throw std::runtime_error("zlib deflateInit failed");
+        strm_ready = true;
+        strm_level = level;
+    } else if (deflateReset(&strm) != Z_OK) {
+        throw std::runtime_error("zlib deflateReset failed");
+    }
+
+    output.resize(deflateBound(&strm, size));
+    strm.avail_in = static_cast<uInt>(size);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    strm.avail_out = static_cast<uInt>(output.size());
+    strm.next_out = reinterpret_cast<Bytef*>(output.data());
+
+    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+        throw std::runtime_error("zlib deflate failed");
+    }
+    output.resize(strm.total_out);
+}
+
+void ChunkEncoder::deflate_block(const CodecParams& params, const char* data, size_t size, size_t dict_size, bool last,
+                                 std::vector<char>& output) {
+    int level = params.level.value_or(Z_DEFAULT_COMPRESSION);
+    if (raw_strm_ready && raw_strm_level != level) {
+        deflateEnd(&raw_strm);
+        raw_strm_ready = false;
+    }
+    if (!raw_strm_ready) {
+        raw_strm = z_stream();
+        // Negative window bits: raw deflate, without the zlib header and Adler-32 trailer
+        if (deflateInit2(&raw_strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("zlib deflateInit2 failed");
+        }
+        raw_strm_ready = true;
+        raw_strm_level = level;
+    } else if (deflateReset(&raw_strm) != Z_OK) {
+        throw std::runtime_error("zlib deflateReset failed");
+    }
+
+    if (dict_size > 0 &&
+        deflateSetDictionary(&raw_strm, reinterpret_cast<const Bytef*>(data - dict_size), static_cast<uInt>(dict_size)) != Z_OK) {
+        throw std::runtime_error("zlib deflateSetDictionary failed");
+    }
+
+    // A sync flush adds an empty stored block on top of what deflateBound covers.
+    output.resize(deflateBound(&raw_strm, size) + 16);
+    raw_strm.avail_in = static_cast<uInt>(size);
+    raw_strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    raw_strm.avail_out = static_cast<uInt>(output.size());
+    raw_strm.next_out = reinterpret_cast<Bytef*>(output.data());
+
+    int ret = deflate(&raw_strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last && ret != Z_STREAM_END) || (!last && (ret != Z_OK || raw_strm.avail_in != 0 || raw_strm.avail_out == 0))) {
+        throw std::runtime_error("zlib deflate failed");
+    }
+    output.resize(raw_strm.total_out);
+}
+
+void ChunkEncoder::zstd_chunk(const CodecParams& params, const char* data, size_t size, std::vector<char>& output) {
+    if (cctx == nullptr) {
+        cctx = ZSTD_createCCtx();
+        if (cctx == nullptr) throw std::runtime_error("ZSTD_createCCtx() failed");
+    }
+
+    // Parameters stay applied across ZSTD_compress2 calls, so they are only set when they change.
+    if (!cctx_params.has_value() || !(*cctx_params == params)) {
+        ZSTD_CCtx_reset(cctx, ZSTD_reset_parameters);
+        auto set = [this](ZSTD_cParameter param, int value) {
+            size_t ret = ZSTD_CCtx_setParameter(cctx, param, value);
+            if (ZSTD_isError(ret)) {
+                throw std::runtime_error("zstd parameter rejected: " + std::string(ZSTD_getErrorName(ret)));
+            }
+        };
+        set(ZSTD_c_compressionLevel, params.level.value_or(ZSTD_CLEVEL_DEFAULT));
+        if (params.zstd_long) set(ZSTD_c_enableLongDistanceMatching, 1);
+        if (params.zstd_window_log != 0) set(ZSTD_c_windowLog, params.zstd_window_log);
+        if (params.zstd_strategy != 0) set(ZSTD_c_strategy, params.zstd_strategy);
+        cctx_params = params;
+    }
+
+    output.resize(ZSTD_compressBound(size));
+    size_t compressed_size = ZSTD_compress2(cctx, output.data(), output.size(), data, size);
+    if (ZSTD_isError(compressed_size)) {
+        throw std::runtime_error("zstd compression failed: " + std::string(ZSTD_getErrorName(compressed_size)));
+    }
+    output.resize(compressed_size);
+}
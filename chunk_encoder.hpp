@@ -0,0 +1,74 @@
+#ifndef CHUNK_ENCODER_HPP
+#define CHUNK_ENCODER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <optional>
+#include <zlib.h>
+#include <zstd.h>
+#include "utils.hpp"
+
+// Compression settings for DZ chunks, stored in metadata.json as dz.codec.
+// Unset fields use the codec defaults, which reproduce the stock output (zlib default level, zstd level 3).
+struct CodecParams {
+    std::string compression;            // "zlib" or "zstd", from dz.compression
+    std::optional<int> level;
+    bool zstd_long = false;             // Long distance matching
+    int zstd_window_log = 0;            // 0: chosen by the level
+    int zstd_strategy = 0;              // ZSTD_strategy value; 0: chosen by the level
+    uint32_t zlib_block_size = 0;       // zlib chunks larger than this are deflated in parallel blocks; 0: never
+
+    // Reads the settings from the "dz" object of metadata.json and validates them.
+    static CodecParams from_metadata(const json& dz_meta);
+    // The dz.codec object describing these settings.
+    json to_json() const;
+    void validate() const;
+    std::string describe() const;
+
+    // Converts between zstd strategy names ("fast" ... "btultra2") and ZSTD_strategy values.
+    static int zstd_strategy_from_name(const std::string& name);
+    static std::string zstd_strategy_name(int strategy);
+
+    bool operator==(const CodecParams& other) const;
+};
+
+// The two byte zlib stream header deflateInit writes for `level`.
+std::vector<char> zlib_stream_header(int level);
+
+// Compression state that persists across chunks: one deflate stream (reset with deflateReset) and one
+// ZSTD_CCtx whose parameters are only reapplied when they change. Each worker thread owns its own instance.
+class ChunkEncoder {
+public:
+    ChunkEncoder();
+    ~ChunkEncoder();
+
+    ChunkEncoder(const ChunkEncoder&) = delete;
+    ChunkEncoder& operator=(const ChunkEncoder&) = delete;
+
+    // Returns the encoder belonging to the calling thread.
+    static ChunkEncoder& for_this_thread();
+
+    // Compresses `size` bytes at `data` into `output`, which is resized to the compressed size.
+    void compress(const CodecParams& params, const char* data, size_t size, std::vector<char>& output);
+    // Deflates one block of a multi-block zlib stream as raw deflate data, primed with the `dict_size` bytes
+    // that precede it. Blocks other than the last end with a sync flush, so the pieces can be concatenated.
+    void deflate_block(const CodecParams& params, const char* data, size_t size, size_t dict_size, bool last,
+                       std::vector<char>& output);
+
+private:
+    void deflate_chunk(const CodecParams& params, const char* data, size_t size, std::vector<char>& output);
+    void zstd_chunk(const CodecParams& params, const char* data, size_t size, std::vector<char>& output);
+
+    z_stream strm;
+    bool strm_ready = false;
+    int strm_level = Z_DEFAULT_COMPRESSION;
+    z_stream raw_strm;
+    bool raw_strm_ready = false;
+    int raw_strm_level = Z_DEFAULT_COMPRESSION;
+    ZSTD_CCtx* cctx = nullptr;
+    std::optional<CodecParams> cctx_params;
+};
+
+#endif // CHUNK_ENCODER_HPP
@@ -0,0 +1,133 @@
+#include "byte_scan.hpp"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BYTE_SCAN_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define BYTE_SCAN_NEON 1
+#endif
+
+// Scalar check for the unaligned head and the tail that does not fill a whole vector block.
+static bool is_all_zero_scalar(const uint8_t* data, size_t size) {
+    uint64_t acc = 0;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        acc |= word;
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+    while (size > 0) {
+        acc |= *data++;
+        --size;
+    }
+    return acc == 0;
+}
+
+bool is_all_zero(const uint8_t* data, size_t size) {
+#if defined(BYTE_SCAN_SSE2)
+    // 64 bytes per iteration: OR four vectors together and test once.
+    while (size >= 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+        __m128i acc = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff) return false;
+        data += 64;
+        size -= 64;
+    }
+#elif defined(BYTE_SCAN_NEON)
+    while (size >= 64) {
+        uint8x16_t a = vld1q_u8(data);
+        uint8x16_t b = vld1q_u8(data + 16);
+        uint8x16_t c = vld1q_u8(data + 32);
+        uint8x16_t d = vld1q_u8(data + 48);
+        uint8x16_t acc = vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d));
+        if (vmaxvq_u8(acc) != 0) return false;
+        data += 64;
+        size -= 64;
+    }
+#endif
+    return is_all_zero_scalar(data, size);
+}
+
+bool is_uniform_u32(const uint8_t* data, size_t size, uint32_t& value) {
+    if (size < sizeof(uint32_t)) return false;
+    uint32_t first;
+    std::memcpy(&first, data, sizeof(first));
+    value = first;
+
+#if defined(BYTE_SCAN_SSE2)
+    __m128i pattern = _mm_set1_epi32(static_cast<int>(first));
+    while (size >= 64) {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), pattern);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), pattern);
+        __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), pattern);
+        __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), pattern);
+        __m128i all = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+        if (_mm_movemask_epi8(all) != 0xffff) return false;
+        data += 64;
+        size -= 64;
+    }
+#elif defined(BYTE_SCAN_NEON)
+    uint32x4_t pattern = vdupq_n_u32(first);
+    while (size >= 64) {
+        uint32x4_t a = vceqq_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(data)), pattern);
+        uint32x4_t b = vceqq_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(data + 16)), pattern);
+        uint32x4_t c = vceqq_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(data + 32)), pattern);
+        uint32x4_t d = vceqq_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(data + 48)), pattern);
+        uint32x4_t all = vandq_u32(vandq_u32(a, b), vandq_u32(c, d));
+        if (vminvq_u32(all) != 0xffffffffu) return false;
+        data += 64;
+        size -= 64;
+    }
+#endif
+    while (size >= sizeof(uint32_t)) {
+        uint32_t word;
+        std::memcpy(&word, data, sizeof(word));
+        if (word != first) return false;
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+    return size == 0;
+}
+
+bool is_uniform_byte(const uint8_t* data, size_t size, uint8_t& value) {
+    if (size == 0) return false;
+    const uint8_t first = data[0];
+    value = first;
+
+#if defined(BYTE_SCAN_SSE2)
+    __m128i pattern = _mm_set1_epi8(static_cast<char>(first));
+    while (size >= 64) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), pattern);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), pattern);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), pattern);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), pattern);
+        __m128i all = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+        if (_mm_movemask_epi8(all) != 0xffff) return false;
+        data += 64;
+        size -= 64;
+    }
+#elif defined(BYTE_SCAN_NEON)
+    uint8x16_t pattern = vdupq_n_u8(first);
+    while (size >= 64) {
+        uint8x16_t a = vceqq_u8(vld1q_u8(data), pattern);
+        uint8x16_t b = vceqq_u8(vld1q_u8(data + 16), pattern);
+        uint8x16_t c = vceqq_u8(vld1q_u8(data + 32), pattern);
+        uint8x16_t d = vceqq_u8(vld1q_u8(data + 48), pattern);
+        uint8x16_t all = vandq_u8(vandq_u8(a, b), vandq_u8(c, d));
+        if (vminvq_u8(all) != 0xff) return false;
+        data += 64;
+        size -= 64;
+    }
+#endif
+    while (size > 0) {
+        if (*data++ != first) return false;
+        --size;
+    }
+    return true;
+}
@@ -0,0 +1,18 @@
+#ifndef BYTE_SCAN_HPP
+#define BYTE_SCAN_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// Returns true if all `size` bytes at `data` are zero.
+// Uses SSE2 on x86-64 and NEON on AArch64, with a portable word-at-a-time fallback.
+bool is_all_zero(const uint8_t* data, size_t size);
+
+// Returns true if `data` is one 32-bit word repeated; `size` must be a multiple of 4.
+// On success the repeated word is stored in `value`.
+bool is_uniform_u32(const uint8_t* data, size_t size, uint32_t& value);
+
+// Returns true if all `size` bytes at `data` equal the first one, which is stored in `value`.
+bool is_uniform_byte(const uint8_t* data, size_t size, uint8_t& value);
+
+#endif // BYTE_SCAN_HPP
@@ -0,0 +1,116 @@
+#include "executors.hpp"
+#include "pipeline_stats.hpp"
+#include <algorithm>
+#include <thread>
+#include <cstdint>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#endif
+
+#if defined(__linux__)
+
+// Quota divided by period, rounded up; 0 when the file is missing or there is no limit.
+static size_t cgroup_cpu_limit(const std::string& quota_text, const std::string& period_text) {
+    if (quota_text.empty() || quota_text == "max" || period_text.empty()) return 0;
+    try {
+        long long quota = std::stoll(quota_text);
+        long long period = std::stoll(period_text);
+        if (quota <= 0 || period <= 0) return 0;
+        return static_cast<size_t>((quota + period - 1) / period);
+    } catch (const std::exception&) {
+        return 0;
+    }
+}
+
+// The tightest CPU quota of this process' cgroup and its ancestors; 0 if there is none.
+static size_t cgroup_cpu_quota() {
+    size_t limit = 0;
+    auto apply = [&limit](size_t cpus) {
+        if (cpus != 0 && (limit == 0 || cpus < limit)) limit = cpus;
+    };
+
+    std::ifstream cgroups("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroups, line)) {
+        // "<id>:<controllers>:<path>"; cgroup v2 is the "0::" entry.
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) continue;
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+
+        if (controllers.empty()) {
+            // A quota anywhere up the hierarchy applies. Inside a container the path may not exist in the
+            // mounted tree; the files at the mount root then belong to the container's own cgroup.
+            for (std::string dir = path;; dir = dir.substr(0, dir.find_last_of('/'))) {
+                std::ifstream cpu_max("/sys/fs/cgroup" + dir + "/cpu.max");
+                std::string quota, period;
+                if (cpu_max >> quota >> period) apply(cgroup_cpu_limit(quota, period));
+                if (dir.empty() || dir == "/") break;
+            }
+        } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+            for (const std::string& root : {std::string("/sys/fs/cgroup/cpu,cpuacct"), std::string("/sys/fs/cgroup/cpu")}) {
+                std::ifstream quota_file(root + path + "/cpu.cfs_quota_us");
+                std::ifstream period_file(root + path + "/cpu.cfs_period_us");
+                std::string quota, period;
+                if (!(quota_file >> quota && period_file >> period)) {
+                    quota_file = std::ifstream(root + "/cpu.cfs_quota_us");
+                    period_file = std::ifstream(root + "/cpu.cfs_period_us");
+                    if (!(quota_file >> quota && period_file >> period)) continue;
+                }
+                apply(cgroup_cpu_limit(quota, period));
+                break;
+            }
+        }
+    }
+    return limit;
+}
+
+#endif
+
+size_t available_cpus() {
+    size_t cpus = std::thread::hardware_concurrency();
+#if defined(_WIN32) || defined(_WIN64)
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) && process_mask != 0) {
+        size_t allowed = 0;
+        for (; process_mask != 0; process_mask &= process_mask - 1) ++allowed;
+        // The mask only covers the current processor group.
+        cpus = std::min(cpus == 0 ? allowed : cpus, allowed);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = static_cast<size_t>(CPU_COUNT(&set));
+    }
+    size_t quota = cgroup_cpu_quota();
+    if (quota != 0) cpus = std::min(cpus, quota);
+#endif
+    return std::max<size_t>(1, cpus);
+}
+
+size_t Executors::default_compute_threads() {
+    return available_cpus();
+}
+
+size_t Executors::default_io_threads() {
+    return std::clamp<size_t>(available_cpus() / 2, 2, 8);
+}
+
+Executors::Executors(size_t compute_threads, size_t io_threads)
+    : compute(compute_threads != 0 ? compute_threads : default_compute_threads()),
+      io(io_threads != 0 ? io_threads : default_io_threads()) {}
+
+Executors::~Executors() {
+    // Stops the queue depth sampler while the pools still exist. Their workers keep recording into the
+    // PoolStats until they are joined, which is why the PipelineStats has to outlive the executors.
+    if (stats) stats->detach();
+}
@@ -0,0 +1,40 @@
+#ifndef EXECUTORS_HPP
+#define EXECUTORS_HPP
+
+#include <cstddef>
+#include "thread_pool.hpp"
+
+// CPUs this process may run on: the scheduler affinity mask, capped by the CPU quota of its cgroup
+// (cpu.max, or cpu.cfs_quota_us under cgroup v1). At least 1.
+size_t available_cpus();
+
+class PipelineStats;
+
+// The two thread pools of a command. Blocking file I/O (reading partition images, paging in compressed
+// chunks, finishing output images) runs on `io`; decompression, compression and hashing run on `compute`.
+// Sized separately, so threads waiting on the disk never take a core away from the codecs.
+class Executors {
+public:
+    // Most threads either pool may be given.
+    static constexpr size_t MAX_THREADS = 1024;
+
+    // A count of 0 picks the default.
+    Executors(size_t compute_threads, size_t io_threads);
+    ~Executors();
+
+    Executors(const Executors&) = delete;
+    Executors& operator=(const Executors&) = delete;
+
+    // One compute thread per available CPU.
+    static size_t default_compute_threads();
+    // Enough threads to keep a few reads in flight; they mostly wait, so they are not counted against the CPUs.
+    static size_t default_io_threads();
+
+    ThreadPool compute;
+    ThreadPool io;
+    // Set while --stats is collecting (by the PipelineStats itself); the pipeline stages record into it.
+    // The PipelineStats must outlive the executors, since pool workers write into it until they are joined.
+    PipelineStats* stats = nullptr;
+};
+
+#endif // EXECUTORS_HPP
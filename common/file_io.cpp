@@ -0,0 +1,405 @@
+#include "file_io.hpp"
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+const uint8_t* MappedFile::slice(uint64_t offset, uint64_t size) const {
+    if (offset > length || size > length - offset) {
+        throw std::runtime_error("Read past end of " + file_path.string() + " (offset " + std::to_string(offset) +
+                                 ", size " + std::to_string(size) + ", file size " + std::to_string(length) + ")");
+    }
+    return base + offset;
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t size) const {
+    const uint8_t* data = slice(offset, size);
+    advise(offset, size, Advice::WillNeed);
+    // One read per page is enough to fault the whole page in.
+    uint8_t touched = 0;
+    for (uint64_t i = 0; i < size; i += 4096) {
+        touched ^= static_cast<const volatile uint8_t*>(data)[i];
+    }
+    (void)touched;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+PositionalWriter::PositionalWriter(const std::filesystem::path& path) : file_path(path) {
+    // FILE_FLAG_OVERLAPPED lets several threads have writes in flight on the same handle.
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open output file: " + path.string());
+    }
+    handle = h;
+
+    // Ranges that are never written stay unallocated, as they do on POSIX file systems.
+    DWORD returned = 0;
+    DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+}
+
+PositionalWriter::~PositionalWriter() {
+    if (handle != nullptr) CloseHandle(static_cast<HANDLE>(handle));
+}
+
+void PositionalWriter::write_at(const void* data, size_t size, uint64_t offset) {
+    const char* p = static_cast<const char*>(data);
+    HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (event == nullptr) {
+        throw std::runtime_error("CreateEvent failed while writing " + file_path.string());
+    }
+    while (size > 0) {
+        DWORD to_write = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        ov.hEvent = event;
+        DWORD written = 0;
+        if (!WriteFile(static_cast<HANDLE>(handle), p, to_write, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING) {
+            CloseHandle(event);
+            throw std::runtime_error("Failed to write to " + file_path.string());
+        }
+        if (!GetOverlappedResult(static_cast<HANDLE>(handle), &ov, &written, TRUE) || written == 0) {
+            CloseHandle(event);
+            throw std::runtime_error("Failed to write to " + file_path.string());
+        }
+        p += written;
+        size -= written;
+        offset += written;
+    }
+    CloseHandle(event);
+}
+
+void PositionalWriter::resize(uint64_t size) {
+    FILE_END_OF_FILE_INFO info = {};
+    info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFileInformationByHandle(static_cast<HANDLE>(handle), FileEndOfFileInfo, &info, sizeof(info))) {
+        throw std::runtime_error("Failed to resize " + file_path.string());
+    }
+}
+
+void PositionalWriter::sync() {
+    if (!FlushFileBuffers(static_cast<HANDLE>(handle))) {
+        throw std::runtime_error("Failed to flush " + file_path.string());
+    }
+}
+
+void PositionalWriter::close() {
+    if (handle != nullptr) {
+        CloseHandle(static_cast<HANDLE>(handle));
+        handle = nullptr;
+    }
+}
+
+PositionalReader::PositionalReader(const std::filesystem::path& path) : file_path(path) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open file " + path.string());
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(h, &file_size)) {
+        CloseHandle(h);
+        throw std::runtime_error("Cannot determine size of " + path.string());
+    }
+    handle = h;
+    length = static_cast<uint64_t>(file_size.QuadPart);
+}
+
+PositionalReader::~PositionalReader() {
+    if (handle != nullptr) CloseHandle(static_cast<HANDLE>(handle));
+}
+
+void PositionalReader::read_range(char* buffer, size_t size, uint64_t offset) const {
+    HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (event == nullptr) {
+        throw std::runtime_error("CreateEvent failed while reading " + file_path.string());
+    }
+    while (size > 0) {
+        DWORD to_read = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        ov.hEvent = event;
+        DWORD read = 0;
+        bool ok = ReadFile(static_cast<HANDLE>(handle), buffer, to_read, nullptr, &ov) ||
+                  GetLastError() == ERROR_IO_PENDING;
+        ok = ok && GetOverlappedResult(static_cast<HANDLE>(handle), &ov, &read, TRUE);
+        if ((!ok && GetLastError() == ERROR_HANDLE_EOF) || (ok && read == 0)) {
+            // Truncated since it was opened; the rest reads as zeros, as on POSIX.
+            std::memset(buffer, 0, size);
+            break;
+        }
+        if (!ok) {
+            CloseHandle(event);
+            throw std::runtime_error("Failed to read from " + file_path.string());
+        }
+        buffer += read;
+        size -= read;
+        offset += read;
+    }
+    CloseHandle(event);
+}
+
+uint64_t PositionalReader::read_at(void* buffer, size_t size, uint64_t offset) const {
+    char* out = static_cast<char*>(buffer);
+    std::memset(out, 0, size);
+    if (offset >= length) return 0;
+    size = static_cast<size_t>(std::min<uint64_t>(size, length - offset));
+
+    // Ask for the allocated ranges inside the request; everything else is a hole and stays zero.
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = static_cast<LONGLONG>(offset);
+    query.Length.QuadPart = static_cast<LONGLONG>(size);
+    FILE_ALLOCATED_RANGE_BUFFER ranges[64];
+    DWORD returned = 0;
+    OVERLAPPED ov = {};
+    ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    BOOL ok = ov.hEvent != nullptr &&
+              (DeviceIoControl(static_cast<HANDLE>(handle), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+                               ranges, sizeof(ranges), nullptr, &ov) ||
+               GetLastError() == ERROR_IO_PENDING) &&
+              GetOverlappedResult(static_cast<HANDLE>(handle), &ov, &returned, TRUE);
+    if (ov.hEvent != nullptr) CloseHandle(ov.hEvent);
+    // Unsupported, or more ranges than fit in one answer: read the request as a whole.
+    if (!ok) {
+        read_range(out, size, offset);
+        return size;
+    }
+
+    uint64_t bytes_read = 0;
+    for (DWORD i = 0; i < returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER); ++i) {
+        uint64_t begin = std::max<uint64_t>(offset, static_cast<uint64_t>(ranges[i].FileOffset.QuadPart));
+        uint64_t end = std::min<uint64_t>(offset + size, static_cast<uint64_t>(ranges[i].FileOffset.QuadPart) +
+                                                             static_cast<uint64_t>(ranges[i].Length.QuadPart));
+        if (begin >= end) continue;
+        read_range(out + (begin - offset), static_cast<size_t>(end - begin), begin);
+        bytes_read += end - begin;
+    }
+    return bytes_read;
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path) : file_path(path) {
+    HANDLE f = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open file " + path.string());
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(f, &file_size)) {
+        CloseHandle(f);
+        throw std::runtime_error("Cannot determine size of " + path.string());
+    }
+    file_handle = f;
+    length = static_cast<uint64_t>(file_size.QuadPart);
+    if (length == 0) return;
+
+    HANDLE m = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m == nullptr) {
+        CloseHandle(f);
+        throw std::runtime_error("Cannot map file " + path.string());
+    }
+    mapping_handle = m;
+    base = static_cast<const uint8_t*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr) {
+        CloseHandle(m);
+        CloseHandle(f);
+        throw std::runtime_error("Cannot map file " + path.string());
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (base != nullptr) UnmapViewOfFile(base);
+    if (mapping_handle != nullptr) CloseHandle(static_cast<HANDLE>(mapping_handle));
+    if (file_handle != nullptr) CloseHandle(static_cast<HANDLE>(file_handle));
+}
+
+void MappedFile::advise(uint64_t, uint64_t, Advice) const {
+    // The Windows cache manager does its own read-ahead on mapped views.
+}
+
+#else
+
+PositionalWriter::PositionalWriter(const std::filesystem::path& path) : file_path(path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open output file: " + path.string() + " (" + std::strerror(errno) + ")");
+    }
+}
+
+PositionalWriter::~PositionalWriter() {
+    if (fd >= 0) ::close(fd);
+}
+
+void PositionalWriter::write_at(const void* data, size_t size, uint64_t offset) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, p, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to write to " + file_path.string() + " (" + std::strerror(errno) + ")");
+        }
+        p += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+}
+
+void PositionalWriter::resize(uint64_t size) {
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        throw std::runtime_error("Failed to resize " + file_path.string() + " (" + std::strerror(errno) + ")");
+    }
+}
+
+void PositionalWriter::sync() {
+    if (::fsync(fd) != 0) {
+        throw std::runtime_error("Failed to flush " + file_path.string() + " (" + std::strerror(errno) + ")");
+    }
+}
+
+void PositionalWriter::close() {
+    if (fd >= 0) {
+        int ret = ::close(fd);
+        fd = -1;
+        if (ret != 0) {
+            throw std::runtime_error("Failed to close " + file_path.string() + " (" + std::strerror(errno) + ")");
+        }
+    }
+}
+
+PositionalReader::PositionalReader(const std::filesystem::path& path) : file_path(path) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file " + path.string() + " (" + std::strerror(errno) + ")");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot determine size of " + path.string() + " (" + std::strerror(errno) + ")");
+    }
+    length = static_cast<uint64_t>(st.st_size);
+}
+
+PositionalReader::~PositionalReader() {
+    if (fd >= 0) ::close(fd);
+}
+
+void PositionalReader::read_range(char* buffer, size_t size, uint64_t offset) const {
+    while (size > 0) {
+        ssize_t read = ::pread(fd, buffer, size, static_cast<off_t>(offset));
+        if (read < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to read from " + file_path.string() + " (" + std::strerror(errno) + ")");
+        }
+        if (read == 0) {
+            // Truncated since it was opened; the rest reads as zeros, like the tail past the end of the file.
+            std::memset(buffer, 0, size);
+            return;
+        }
+        buffer += read;
+        size -= static_cast<size_t>(read);
+        offset += static_cast<uint64_t>(read);
+    }
+}
+
+uint64_t PositionalReader::read_at(void* buffer, size_t size, uint64_t offset) const {
+    char* out = static_cast<char*>(buffer);
+    if (offset >= length) {
+        std::memset(out, 0, size);
+        return 0;
+    }
+    const uint64_t end = offset + std::min<uint64_t>(size, length - offset);
+    std::memset(out + (end - offset), 0, static_cast<size_t>(offset + size - end));
+
+    uint64_t bytes_read = 0;
+    uint64_t pos = offset;
+    while (pos < end) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t data = ::lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            // No data at or after pos: the rest of the request is a hole.
+            data = static_cast<off_t>(end);
+        }
+        if (data >= 0) {
+            uint64_t data_start = std::min<uint64_t>(static_cast<uint64_t>(data), end);
+            std::memset(out + (pos - offset), 0, static_cast<size_t>(data_start - pos));
+            pos = data_start;
+            if (pos >= end) break;
+            off_t hole = ::lseek(fd, static_cast<off_t>(pos), SEEK_HOLE);
+            uint64_t data_end = hole < 0 ? end : std::min<uint64_t>(static_cast<uint64_t>(hole), end);
+            read_range(out + (pos - offset), static_cast<size_t>(data_end - pos), pos);
+            bytes_read += data_end - pos;
+            pos = data_end;
+            continue;
+        }
+#endif
+        // No hole detection on this file system: read the rest as is.
+        read_range(out + (pos - offset), static_cast<size_t>(end - pos), pos);
+        bytes_read += end - pos;
+        break;
+    }
+    return bytes_read;
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path) : file_path(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file " + path.string() + " (" + std::strerror(errno) + ")");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot determine size of " + path.string() + " (" + std::strerror(errno) + ")");
+    }
+    length = static_cast<uint64_t>(st.st_size);
+    if (length > 0) {
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map file " + path.string() + " (" + std::strerror(errno) + ")");
+        }
+        base = static_cast<const uint8_t*>(p);
+    }
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (base != nullptr) ::munmap(const_cast<uint8_t*>(base), length);
+}
+
+void MappedFile::advise(uint64_t offset, uint64_t size, Advice advice) const {
+    if (base == nullptr || offset >= length) return;
+    size = std::min(size, length - offset);
+
+    // madvise needs a page aligned start address.
+    static const uint64_t page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    uint64_t aligned = offset - (offset % page_size);
+    size += offset - aligned;
+
+    int flag = MADV_NORMAL;
+    switch (advice) {
+        case Advice::Normal: flag = MADV_NORMAL; break;
+        case Advice::Sequential: flag = MADV_SEQUENTIAL; break;
+        case Advice::WillNeed: flag = MADV_WILLNEED; break;
+        case Advice::DontNeed: flag = MADV_DONTNEED; break;
+    }
+    // Hints only; failures are harmless.
+    ::madvise(const_cast<uint8_t*>(base + aligned), size, flag);
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FILE_IO_HPP
+#define FILE_IO_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+
+// Output file that supports concurrent positional writes. Created as a sparse file where the platform needs it.
+// Every write carries its own offset (pwrite on POSIX, overlapped WriteFile on Windows),
+// so worker threads never share a seek position and need no lock around the handle.
+class PositionalWriter {
+public:
+    // Creates (or truncates) the file at the given path.
+    explicit PositionalWriter(const std::filesystem::path& path);
+    ~PositionalWriter();
+
+    PositionalWriter(const PositionalWriter&) = delete;
+    PositionalWriter& operator=(const PositionalWriter&) = delete;
+
+    // Writes exactly `size` bytes at absolute file offset `offset`. Safe to call concurrently.
+    void write_at(const void* data, size_t size, uint64_t offset);
+    // Sets the file length, extending it with a sparse tail where the file system allows.
+    void resize(uint64_t size);
+    // Flushes the written data and the file size to stable storage (fsync / FlushFileBuffers).
+    void sync();
+    void close();
+
+    const std::filesystem::path& path() const { return file_path; }
+
+private:
+    std::filesystem::path file_path;
+#if defined(_WIN32) || defined(_WIN64)
+    void* handle;
+#else
+    int fd = -1;
+#endif
+};
+
+// Input file for concurrent positional reads (pread on POSIX, overlapped ReadFile on Windows).
+// Holes in sparse files are not read: ranges the file system reports as unallocated (SEEK_HOLE on POSIX,
+// FSCTL_QUERY_ALLOCATED_RANGES on Windows) are zero-filled in memory instead.
+class PositionalReader {
+public:
+    explicit PositionalReader(const std::filesystem::path& path);
+    ~PositionalReader();
+
+    PositionalReader(const PositionalReader&) = delete;
+    PositionalReader& operator=(const PositionalReader&) = delete;
+
+    // Fills `size` bytes at `buffer` from file offset `offset`. Holes and anything past the end of the file
+    // read as zeros. Returns the number of bytes actually read from disk. Safe to call concurrently.
+    uint64_t read_at(void* buffer, size_t size, uint64_t offset) const;
+
+    uint64_t size() const { return length; }
+    const std::filesystem::path& path() const { return file_path; }
+
+private:
+    // Reads [offset, offset + size) with no hole detection.
+    void read_range(char* buffer, size_t size, uint64_t offset) const;
+
+    std::filesystem::path file_path;
+    uint64_t length = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    void* handle;
+#else
+    int fd = -1;
+#endif
+};
+
+// Read-only memory mapping of a whole input file.
+// Decoders and hash verifiers read straight from the mapping instead of copying through a stream buffer.
+class MappedFile {
+public:
+    enum class Advice { Normal, Sequential, WillNeed, DontNeed };
+
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return base; }
+    uint64_t size() const { return length; }
+
+    // Returns a pointer to [offset, offset + size), throwing if the range lies outside the file.
+    const uint8_t* slice(uint64_t offset, uint64_t size) const;
+    // Passes an access pattern hint for a byte range to the kernel (madvise). DontNeed only unmaps the range from
+    // this process; the pages stay in the shared page cache for other readers of the file. No-op where unsupported.
+    void advise(uint64_t offset, uint64_t size, Advice advice) const;
+    // Faults a byte range in on the calling thread, so later reads from the mapping do not wait for the disk.
+    void prefetch(uint64_t offset, uint64_t size) const;
+
+    const std::filesystem::path& path() const { return file_path; }
+
+private:
+    std::filesystem::path file_path;
+    const uint8_t* base = nullptr;
+    uint64_t length = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+#endif // FILE_IO_HPP
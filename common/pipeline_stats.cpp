@@ -0,0 +1,267 @@
+#include "pipeline_stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::Read: return "read";
+        case Stage::Inflate: return "inflate";
+        case Stage::Deflate: return "deflate";
+        case Stage::Md5: return "md5";
+        case Stage::Crc: return "crc";
+        case Stage::Write: return "write";
+    }
+    return "unknown";
+}
+
+void PartitionStats::add(Stage stage, uint64_t bytes_in, uint64_t bytes_out, uint64_t ns) {
+    StageCounters& counters = stages[static_cast<size_t>(stage)];
+    counters.calls.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    counters.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+    counters.ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+PipelineStats::PipelineStats(Executors& executors)
+    : executors(&executors), started_ns(stats_clock_ns()), compute_threads(executors.compute.size()),
+      io_threads(executors.io.size()) {
+    executors.compute.set_stats(&compute_pool);
+    executors.io.set_stats(&io_pool);
+    executors.stats = this;
+    sampler = std::thread([this] { sample_loop(); });
+}
+
+PipelineStats::~PipelineStats() {
+    detach();
+}
+
+void PipelineStats::detach() {
+    finish();
+    if (!executors) return;
+    // The pools keep their pointer to the PoolStats; the workers that are still running may be using it.
+    executors->stats = nullptr;
+    executors = nullptr;
+}
+
+PartitionStats& PipelineStats::partition(uint32_t hw_part, const std::string& name) {
+    return partition(std::to_string(hw_part) + "." + name);
+}
+
+PartitionStats& PipelineStats::partition(const std::string& label) {
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    std::unique_ptr<PartitionStats>& stats = partitions[label];
+    if (!stats) stats = std::make_unique<PartitionStats>();
+    return *stats;
+}
+
+PartitionStats* whole_dz_stats(const Executors& executors) {
+    return executors.stats ? &executors.stats->partition(PipelineStats::WHOLE_DZ) : nullptr;
+}
+
+void PipelineStats::sample_loop() {
+    std::unique_lock<std::mutex> lock(sample_mutex);
+    while (sampling) {
+        samples.push_back({(stats_clock_ns() - started_ns) / 1000,
+                           executors->compute.queued(), compute_pool.running.load(),
+                           executors->io.queued(), io_pool.running.load()});
+        if (samples.size() >= MAX_SAMPLES) {
+            // Halve the resolution of the whole series, keeping its first sample.
+            size_t kept = 0;
+            for (size_t i = 0; i < samples.size(); i += 2) samples[kept++] = samples[i];
+            samples.resize(kept);
+            sample_interval_us *= 2;
+        }
+        sample_wake.wait_for(lock, std::chrono::microseconds(sample_interval_us), [this] { return !sampling; });
+    }
+}
+
+void PipelineStats::finish() {
+    {
+        std::lock_guard<std::mutex> lock(sample_mutex);
+        if (!sampling) return;
+        sampling = false;
+    }
+    sample_wake.notify_all();
+    sampler.join();
+    finished_ns = stats_clock_ns();
+    // The last tasks have signalled their completion, but their workers may not have recorded them yet. Wait for
+    // the pools to go idle, giving up after a second in case something still running is unrelated to the command.
+    const uint64_t deadline = stats_clock_ns() + 1000000000ull;
+    while ((compute_pool.running.load() != 0 || io_pool.running.load() != 0) && stats_clock_ns() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+static std::string format_duration(uint64_t ns) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1);
+    if (ns < 10000) oss << ns << " ns";
+    else if (ns < 10000000) oss << ns / 1e3 << " us";
+    else if (ns < 10000000000ull) oss << ns / 1e6 << " ms";
+    else oss << ns / 1e9 << " s";
+    return oss.str();
+}
+
+static std::string format_bytes(uint64_t bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024;
+        ++unit;
+    }
+    std::ostringstream oss;
+    if (unit == 0) oss << bytes << " B";
+    else oss << std::fixed << std::setprecision(1) << value << " " << units[unit];
+    return oss.str();
+}
+
+// Input bytes per second of thread time, in MiB/s.
+static double stage_rate(uint64_t bytes, uint64_t ns) {
+    return ns == 0 ? 0.0 : static_cast<double>(bytes) / (1024.0 * 1024.0) / (static_cast<double>(ns) / 1e9);
+}
+
+static json histogram_json(const LatencyHistogram& histogram) {
+    json buckets = json::array();
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) buckets.push_back(histogram.bucket(i));
+    // Trailing empty buckets carry no information.
+    while (!buckets.empty() && buckets.back() == 0) buckets.erase(buckets.size() - 1);
+    return {
+        {"count", histogram.count()},
+        {"total_ns", histogram.total_ns()},
+        {"p50_ns", histogram.percentile(0.5)},
+        {"p90_ns", histogram.percentile(0.9)},
+        {"p99_ns", histogram.percentile(0.99)},
+        {"max_ns", histogram.max_ns()},
+        {"log2_buckets", buckets}
+    };
+}
+
+static json stage_json(const StageCounters& counters) {
+    return {
+        {"calls", counters.calls.load()},
+        {"bytes_in", counters.bytes_in.load()},
+        {"bytes_out", counters.bytes_out.load()},
+        {"ns", counters.ns.load()}
+    };
+}
+
+json PipelineStats::to_json() {
+    finish();
+    json doc;
+    doc["wall_ns"] = finished_ns - started_ns;
+
+    auto pool_json = [](size_t threads, const PoolStats& stats) {
+        return json{
+            {"threads", threads},
+            {"max_queued", stats.max_queued.load()},
+            {"steals", stats.steals.load()},
+            {"contended_locks", stats.contended_locks.load()},
+            {"wait", histogram_json(stats.wait)},
+            {"run", histogram_json(stats.run)}
+        };
+    };
+    doc["pools"]["compute"] = pool_json(compute_threads, compute_pool);
+    doc["pools"]["io"] = pool_json(io_threads, io_pool);
+
+    json series = json::array();
+    for (const auto& sample : samples) {
+        series.push_back({{"t_us", sample.at_us},
+                          {"compute_queued", sample.compute_queued}, {"compute_running", sample.compute_running},
+                          {"io_queued", sample.io_queued}, {"io_running", sample.io_running}});
+    }
+    doc["queue_depth"] = {{"interval_us", sample_interval_us}, {"samples", series}};
+
+    json parts = json::object();
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    for (const auto& entry : partitions) {
+        json stages = json::object();
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            const StageCounters& counters = entry.second->stage(static_cast<Stage>(s));
+            if (counters.calls.load() == 0) continue;
+            stages[stage_name(static_cast<Stage>(s))] = stage_json(counters);
+        }
+        parts[entry.first] = stages;
+    }
+    doc["partitions"] = parts;
+
+    json stage_totals = json::object();
+    for (size_t s = 0; s < STAGE_COUNT; ++s) {
+        StageCounters sum;
+        for (const auto& entry : partitions) {
+            const StageCounters& counters = entry.second->stage(static_cast<Stage>(s));
+            sum.calls += counters.calls.load();
+            sum.bytes_in += counters.bytes_in.load();
+            sum.bytes_out += counters.bytes_out.load();
+            sum.ns += counters.ns.load();
+        }
+        if (sum.calls.load() == 0) continue;
+        stage_totals[stage_name(static_cast<Stage>(s))] = stage_json(sum);
+    }
+    doc["stages"] = stage_totals;
+    return doc;
+}
+
+void PipelineStats::print(std::ostream& out) {
+    json doc = to_json();
+    const uint64_t wall_ns = doc["wall_ns"];
+
+    out << "\nStats (wall time " << format_duration(wall_ns) << "):" << std::endl;
+
+    out << "  Executors:" << std::endl;
+    for (const char* name : {"compute", "io"}) {
+        const json& pool = doc["pools"][name];
+        const json& wait = pool["wait"];
+        const json& run = pool["run"];
+        out << "    " << std::left << std::setw(8) << name << std::right << pool["threads"].get<size_t>()
+            << " threads, " << wait["count"].get<uint64_t>() << " tasks, at most " << pool["max_queued"].get<size_t>()
+            << " queued, " << pool["steals"].get<uint64_t>() << " steals, " << pool["contended_locks"].get<uint64_t>()
+            << " contended deque locks" << std::endl;
+        out << "             wait p50 " << format_duration(wait["p50_ns"]) << ", p99 " << format_duration(wait["p99_ns"])
+            << ", max " << format_duration(wait["max_ns"]) << "; run p50 " << format_duration(run["p50_ns"])
+            << ", p99 " << format_duration(run["p99_ns"]) << ", max " << format_duration(run["max_ns"]) << std::endl;
+    }
+
+    // Mean and peak of the sampled series; the whole series is in the JSON report.
+    const json& series = doc["queue_depth"]["samples"];
+    if (!series.empty()) {
+        out << "  Queue depth over " << series.size() << " samples:";
+        for (const char* name : {"compute", "io"}) {
+            uint64_t queued_sum = 0, queued_max = 0, running_sum = 0;
+            for (const auto& sample : series) {
+                uint64_t queued = sample[std::string(name) + "_queued"];
+                queued_sum += queued;
+                queued_max = std::max(queued_max, queued);
+                running_sum += sample[std::string(name) + "_running"].get<uint64_t>();
+            }
+            out << std::fixed << std::setprecision(1) << " " << name << " mean " << double(queued_sum) / series.size()
+                << " queued (peak " << queued_max << "), " << double(running_sum) / series.size() << " busy;";
+        }
+        out << std::endl;
+    }
+
+    auto print_stage = [&out, wall_ns](const std::string& label, const std::string& stage, const json& counters) {
+        uint64_t ns = counters["ns"];
+        uint64_t bytes_in = counters["bytes_in"];
+        out << "    " << std::left << std::setw(24) << label << std::setw(9) << stage << std::right
+            << std::setw(8) << counters["calls"].get<uint64_t>() << std::setw(12) << format_bytes(bytes_in)
+            << std::setw(12) << format_bytes(counters["bytes_out"]) << std::setw(11) << format_duration(ns)
+            << std::fixed << std::setprecision(1) << std::setw(10) << stage_rate(bytes_in, ns)
+            << std::setw(9) << (wall_ns == 0 ? 0.0 : double(ns) / double(wall_ns)) << std::endl;
+    };
+    const std::string header = "                                       calls    bytes in   bytes out       time     MiB/s  threads";
+
+    if (!doc["partitions"].empty()) {
+        out << "  Stages per partition (time summed over threads; 'threads' is time / wall time):" << std::endl;
+        out << header << std::endl;
+        for (const auto& part : doc["partitions"].items()) {
+            for (const auto& stage : part.value().items()) print_stage(part.key(), stage.key(), stage.value());
+        }
+        out << "  Stages in total:" << std::endl;
+        out << header << std::endl;
+        for (const auto& stage : doc["stages"].items()) print_stage("all", stage.key(), stage.value());
+    }
+    out << std::defaultfloat;
+}
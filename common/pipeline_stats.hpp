@@ -0,0 +1,129 @@
+#ifndef PIPELINE_STATS_HPP
+#define PIPELINE_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pool_stats.hpp"
+#include "executors.hpp"
+#include "utils.hpp"
+
+// Steps of the extraction and repack pipelines that --stats times separately.
+enum class Stage { Read, Inflate, Deflate, Md5, Crc, Write };
+constexpr size_t STAGE_COUNT = 6;
+const char* stage_name(Stage stage);
+
+// Totals of one stage. `ns` is the time threads spent in it, summed over threads, so a stage can add up to more
+// than the wall time of the run.
+struct StageCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> ns{0};
+};
+
+// Per-stage counters of one partition. Safe to update from any thread.
+class PartitionStats {
+public:
+    void add(Stage stage, uint64_t bytes_in, uint64_t bytes_out, uint64_t ns);
+    const StageCounters& stage(Stage stage) const { return stages[static_cast<size_t>(stage)]; }
+
+private:
+    std::array<StageCounters, STAGE_COUNT> stages;
+};
+
+// Times one step of a stage. Without a PartitionStats it does nothing, not even read the clock.
+class StageTimer {
+public:
+    StageTimer(PartitionStats* stats, Stage stage) : stats(stats), stage(stage), started(stats ? stats_clock_ns() : 0) {}
+
+    // Records the step. `excluded_ns` is time spent inside it on another stage, such as the writes a decoder's
+    // sink makes, which that stage records itself.
+    void done(uint64_t bytes_in, uint64_t bytes_out, uint64_t excluded_ns = 0) {
+        if (!stats) return;
+        uint64_t elapsed = stats_clock_ns() - started;
+        stats->add(stage, bytes_in, bytes_out, elapsed > excluded_ns ? elapsed - excluded_ns : 0);
+    }
+
+private:
+    PartitionStats* stats;
+    Stage stage;
+    uint64_t started;
+};
+
+// Everything --stats collects during one command: task latency and queue depth of both executors, and the
+// bytes and time of every stage, per partition. Constructing it attaches it to the executors and starts a
+// thread that samples their queue depth. It must outlive the executors: their pool workers record into it
+// until they are joined, and the executors detach it when they are destroyed.
+class PipelineStats {
+public:
+    // Label of the work that covers the whole DZ rather than one partition, such as the data hash.
+    static constexpr const char* WHOLE_DZ = "dz";
+
+    explicit PipelineStats(Executors& executors);
+    ~PipelineStats();
+
+    PipelineStats(const PipelineStats&) = delete;
+    PipelineStats& operator=(const PipelineStats&) = delete;
+
+    // The counters of a partition, labelled "<hw>.<name>", created on first use. The reference stays valid.
+    PartitionStats& partition(uint32_t hw_part, const std::string& name);
+    PartitionStats& partition(const std::string& label);
+
+    // Stops the clock and the queue depth sampling, then waits for the pool workers to record their last tasks.
+    // The reports call it; later calls do nothing.
+    void finish();
+    // Stops sampling and forgets the executors, leaving their PoolStats in place. Called by ~Executors.
+    void detach();
+    void print(std::ostream& out);
+    json to_json();
+
+    PoolStats compute_pool;
+    PoolStats io_pool;
+
+private:
+    // Queue depth and busy workers of both executors at one point of the run.
+    struct QueueSample {
+        uint64_t at_us;
+        size_t compute_queued;
+        size_t compute_running;
+        size_t io_queued;
+        size_t io_running;
+    };
+
+    void sample_loop();
+
+    // Null once detached.
+    Executors* executors;
+    uint64_t started_ns;
+    // Thread counts, kept for the reports after the executors are gone.
+    size_t compute_threads;
+    size_t io_threads;
+    uint64_t finished_ns = 0;
+
+    std::mutex partitions_mutex;
+    std::map<std::string, std::unique_ptr<PartitionStats>> partitions;
+
+    // The series is kept under MAX_SAMPLES by dropping every other sample and doubling the interval.
+    static constexpr size_t MAX_SAMPLES = 2048;
+    std::mutex sample_mutex;
+    std::condition_variable sample_wake;
+    bool sampling = true;
+    uint64_t sample_interval_us = 10000;
+    std::vector<QueueSample> samples;
+    std::thread sampler;
+};
+
+// The counters for work on the whole DZ (PipelineStats::WHOLE_DZ), or null when no stats are being collected.
+PartitionStats* whole_dz_stats(const Executors& executors);
+
+#endif // PIPELINE_STATS_HPP
@@ -0,0 +1,81 @@
+#ifndef POOL_STATS_HPP
+#define POOL_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Monotonic clock in nanoseconds, for the instrumentation counters.
+inline uint64_t stats_clock_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Lock-free histogram of durations with power-of-two buckets: bucket i counts samples in [2^i, 2^(i+1)) ns.
+// The last bucket also takes everything longer.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 40;
+
+    void record(uint64_t ns) {
+        size_t bucket = 0;
+        for (uint64_t v = ns >> 1; v != 0 && bucket + 1 < BUCKETS; v >>= 1) ++bucket;
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = longest.load(std::memory_order_relaxed);
+        while (ns > seen && !longest.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return samples.load(); }
+    uint64_t total_ns() const { return total.load(); }
+    uint64_t max_ns() const { return longest.load(); }
+    uint64_t bucket(size_t i) const { return buckets[i].load(); }
+    // Upper bound of the bucket holding the p-th fraction of the samples (0 < p <= 1), capped by the maximum.
+    uint64_t percentile(double p) const {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(n));
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += bucket(i);
+            if (seen >= rank) {
+                uint64_t upper = (uint64_t(1) << (i + 1)) - 1;
+                return upper < max_ns() ? upper : max_ns();
+            }
+        }
+        return max_ns();
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> longest{0};
+};
+
+// Counters a ThreadPool fills while one is attached with ThreadPool::set_stats().
+struct PoolStats {
+    // Time from queueing a task to a worker starting it, and the time it ran.
+    LatencyHistogram wait;
+    LatencyHistogram run;
+    // Tasks a worker took from another worker's deque.
+    std::atomic<uint64_t> steals{0};
+    // Deque lock acquisitions that found the lock held and had to block.
+    std::atomic<uint64_t> contended_locks{0};
+    // Most tasks queued at once, and the workers running a task right now.
+    std::atomic<size_t> max_queued{0};
+    std::atomic<size_t> running{0};
+
+    void note_queued(size_t queued) {
+        size_t seen = max_queued.load(std::memory_order_relaxed);
+        while (queued > seen && !max_queued.compare_exchange_weak(seen, queued, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+#endif // POOL_STATS_HPP
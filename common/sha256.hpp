@@ -0,0 +1,26 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// SHA-256 (FIPS 180-4). Used where a key must not collide even for crafted input, which MD5 cannot promise.
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const void* data, size_t size);
+    // Finishes the hash and returns it as 64 lowercase hex digits. No more data may be added afterwards.
+    std::string hexdigest();
+
+private:
+    void transform(const uint8_t block[64]);
+
+    uint32_t state[8];
+    uint64_t total_bytes = 0;
+    uint8_t buffer[64];
+    size_t buffered = 0;
+};
+
+#endif // SHA256_HPP
@@ -97,6 +97,27 @@ struct DzChunkHeaderV1 {
     char padding[356];
 };
 
+// Android sparse image (simg) file header
+struct SparseImageHeader {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+};
+
+// Android sparse image chunk header
+struct SparseChunkHeader {
+    uint16_t chunk_type;
+    uint16_t reserved1;
+    uint32_t chunk_sz;  // in blocks
+    uint32_t total_sz;  // in bytes, including this header
+};
+
 // Restore default packing alignment
 #pragma pack(pop)
 
@@ -112,4 +133,9 @@ constexpr uint32_t KDZV3_MAGIC = 0x25223824;
 constexpr uint64_t EXTENDED_MEM_ID_OFFSET = 0x14738;
 constexpr uint32_t DZ_MAGIC = 0x74189632;
 constexpr uint32_t DZ_PART_MAGIC = 0x78951230;
+constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
+constexpr uint32_t SPARSE_BLOCK_SIZE = 4096;
+constexpr uint16_t SPARSE_CHUNK_RAW = 0xCAC1;
+constexpr uint16_t SPARSE_CHUNK_FILL = 0xCAC2;
+constexpr uint16_t SPARSE_CHUNK_DONT_CARE = 0xCAC3;
 #endif
\ No newline at end of file
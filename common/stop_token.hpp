@@ -0,0 +1,43 @@
+#ifndef STOP_TOKEN_HPP
+#define STOP_TOKEN_HPP
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+// Thrown by work that gives up because its StopToken was triggered.
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+// Cooperative cancellation shared by all tasks of one operation. The first task that fails calls
+// request_stop() with its exception; the others check the token between units of work and bail out,
+// so a bad chunk fails the whole operation right away instead of after every other chunk is done.
+class StopToken {
+public:
+    // Only the first error is kept: later ones are usually consequences of the stop. The flag is set under the
+    // lock, so of two tasks failing at once exactly one sees the token unstopped and records its error.
+    void request_stop(std::exception_ptr reason = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!stopped.load() && reason) first_error = reason;
+        stopped.store(true);
+    }
+    bool stop_requested() const { return stopped.load(std::memory_order_relaxed); }
+    void throw_if_stopped() const {
+        if (stop_requested()) throw OperationCancelled();
+    }
+    // The exception that triggered the stop, if any.
+    std::exception_ptr error() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return first_error;
+    }
+
+private:
+    std::atomic<bool> stopped{false};
+    mutable std::mutex mutex;
+    std::exception_ptr first_error;
+};
+
+#endif // STOP_TOKEN_HPP
@@ -2,97 +2,479 @@
 #define THREAD_POOL_HPP
 
 #include <vector>
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include "stop_token.hpp"
+#include "pool_stats.hpp"
 
+// Move-only type-erased void() callable. Callables of up to INLINE_SIZE bytes are stored inside the object,
+// so queueing them allocates nothing; larger ones are moved to the heap.
+class PoolTask {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    PoolTask() = default;
+
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, PoolTask>::value>::type>
+    PoolTask(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        if constexpr (fits_inline<Fn>()) {
+            new (storage) Fn(std::forward<F>(f));
+            ops = inline_ops<Fn>();
+        } else {
+            *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+            ops = heap_ops<Fn>();
+        }
+    }
+
+    PoolTask(PoolTask&& other) noexcept { take(other); }
+    PoolTask& operator=(PoolTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    PoolTask(const PoolTask&) = delete;
+    PoolTask& operator=(const PoolTask&) = delete;
+    ~PoolTask() { reset(); }
+
+    explicit operator bool() const { return ops != nullptr; }
+    void operator()() { ops->invoke(storage); }
+
+    // When the task was queued (stats_clock_ns), or 0 if its pool was not collecting stats.
+    uint64_t queued_at = 0;
+
+private:
+    struct Ops {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* self);
+    };
+
+    template<class Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<class Fn>
+    static const Ops* inline_ops() {
+        static const Ops ops = {
+            [](void* self) { (*static_cast<Fn*>(self))(); },
+            [](void* dst, void* src) {
+                new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+                static_cast<Fn*>(src)->~Fn();
+            },
+            [](void* self) { static_cast<Fn*>(self)->~Fn(); }
+        };
+        return &ops;
+    }
+
+    template<class Fn>
+    static const Ops* heap_ops() {
+        static const Ops ops = {
+            [](void* self) { (**static_cast<Fn**>(self))(); },
+            [](void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); },
+            [](void* self) { delete *static_cast<Fn**>(self); }
+        };
+        return &ops;
+    }
+
+    void take(PoolTask& other) {
+        queued_at = other.queued_at;
+        ops = other.ops;
+        if (ops != nullptr) {
+            ops->move(storage, other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    void reset() {
+        if (ops != nullptr) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    const Ops* ops = nullptr;
+};
+
+// Completion handle of a ThreadPool::submit_bulk batch.
+class BulkHandle {
+public:
+    BulkHandle() = default;
+
+    // Blocks until every task of the batch has run or been skipped, then rethrows the first exception any of
+    // them threw. If the batch's StopToken was triggered, it throws the token's error, or OperationCancelled,
+    // so it only returns normally when every task ran. Must not be called from a task of the same pool.
+    void wait() {
+        if (!state) return;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(lock, [this] { return state->remaining.load() == 0; });
+        if (state->stop && state->stop->stop_requested()) {
+            std::exception_ptr reason = state->stop->error();
+            if (reason) std::rethrow_exception(reason);
+        }
+        if (state->error) std::rethrow_exception(state->error);
+        if (state->stop && state->stop->stop_requested()) throw OperationCancelled();
+    }
+    bool finished() const { return !state || state->remaining.load() == 0; }
+
+private:
+    friend class ThreadPool;
+
+    struct State {
+        std::function<void(size_t)> fn;
+        StopToken* stop = nullptr;
+        std::atomic<size_t> remaining{0};
+        // The next index to run. Each queued task claims one when it starts, so indices run in order
+        // no matter which worker, owner or thief, picks the task up.
+        std::atomic<size_t> next_index{0};
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+
+        void run(size_t index) {
+            try {
+                // Once the batch is stopped, the tasks still queued complete without doing anything.
+                if (!stop || !stop->stop_requested()) fn(index);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                }
+                if (stop) stop->request_stop(std::current_exception());
+            }
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    };
+    std::shared_ptr<State> state;
+};
+
+// Scheduling class of a pool task. Workers take every queued High task, their own or stolen, before any Normal one.
+enum class TaskPriority { High, Normal };
+
+// Work-stealing thread pool. Every worker owns a deque guarded by its own lock: it takes tasks from the front
+// of its deque, and an idle worker steals from the back of the others, so submitters and workers rarely touch
+// the same lock. Tasks submitted from a worker go to that worker's deque; others are spread round-robin.
 class ThreadPool {
 public:
     ThreadPool(size_t threads);
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    // Queues `f` without creating a future, so nothing is allocated for callables that fit in a PoolTask.
+    // `f` must not throw; work that can fail reports through its own promise or state.
+    template<class F>
+    void post(F&& f, TaskPriority priority = TaskPriority::Normal);
+    // Queues `count` tasks that call fn(0) ... fn(count - 1), taking each worker's lock only once. The indices
+    // are started in ascending order, however the tasks are spread over or stolen between the workers.
+    // The batch shares one allocation instead of one future per task. With a stop `token`, the first task that
+    // throws triggers it, and tasks that have not started yet are skipped once it is triggered.
+    template<class F>
+    BulkHandle submit_bulk(size_t count, F&& fn, StopToken* token = nullptr,
+                           TaskPriority priority = TaskPriority::Normal);
+    size_t size() const { return workers.size(); }
+    // Tasks queued and not yet taken by a worker.
+    size_t queued() const { return pending.load(); }
+    // Starts (or, with null, stops) filling `stats`. Costs a clock read per task while attached.
+    void set_stats(PoolStats* pool_stats) { stats.store(pool_stats); }
     ~ThreadPool();
 private:
-    // Need to keep track of threads so we can join them
-    std::vector< std::thread > workers;
-    // The task queue
-    std::queue< std::function<void()> > tasks;
-    
-    // Synchronization
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop;
+    // Ring buffer of tasks; it only allocates when it has to grow.
+    struct TaskRing {
+        std::vector<PoolTask> ring;
+        size_t head = 0;
+        size_t count = 0;
+
+        explicit TaskRing(size_t capacity) : ring(capacity) {}
+
+        void push_back(PoolTask&& task) {
+            if (count == ring.size()) {
+                std::vector<PoolTask> grown(ring.size() * 2);
+                for (size_t i = 0; i < count; ++i) grown[i] = std::move(ring[(head + i) % ring.size()]);
+                ring.swap(grown);
+                head = 0;
+            }
+            ring[(head + count) % ring.size()] = std::move(task);
+            ++count;
+        }
+        bool pop_front(PoolTask& task) {
+            if (count == 0) return false;
+            task = std::move(ring[head]);
+            head = (head + 1) % ring.size();
+            --count;
+            return true;
+        }
+        bool pop_back(PoolTask& task) {
+            if (count == 0) return false;
+            task = std::move(ring[(head + count - 1) % ring.size()]);
+            --count;
+            return true;
+        }
+    };
+
+    // One ring per TaskPriority, both guarded by the worker's lock.
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        TaskRing high{16};
+        TaskRing normal{256};
+
+        TaskRing& ring(TaskPriority priority) { return priority == TaskPriority::High ? high : normal; }
+    };
+
+    struct WorkerSlot {
+        const ThreadPool* pool = nullptr;
+        size_t index = 0;
+    };
+    static WorkerSlot& current_worker() {
+        thread_local WorkerSlot slot;
+        return slot;
+    }
+
+    // The deque a task submitted by the calling thread goes to.
+    size_t submit_queue();
+    // Locks a worker's deque, counting the acquisitions that had to wait.
+    std::unique_lock<std::mutex> lock_queue(WorkerQueue& queue);
+    // Timestamp for tasks queued now, 0 while no stats are attached.
+    uint64_t queue_stamp() const { return stats.load(std::memory_order_relaxed) ? stats_clock_ns() : 0; }
+    // Counts tasks just pushed onto a deque. Called with that deque's lock still held, so no worker can take
+    // them before they are counted and `pending` never drops below zero.
+    void count_queued(size_t added, TaskPriority priority);
+    // Wakes sleeping workers for `added` new tasks.
+    void notify(size_t added);
+    // Takes a task of the given priority from the worker's own deque, or steals one.
+    bool pop_from(size_t self, TaskPriority priority, PoolTask& task);
+    bool try_pop(size_t self, PoolTask& task);
+    void worker_loop(size_t index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+
+    // Queued tasks not yet taken by a worker; idle workers sleep until it becomes non-zero.
+    std::atomic<size_t> pending{0};
+    // The High part of `pending`, so workers only look for High tasks when there are some.
+    std::atomic<size_t> pending_high{0};
+    std::atomic<size_t> sleeping{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stop{false};
+    std::atomic<PoolStats*> stats{nullptr};
 };
- 
+
 // The constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
 {
-    for(size_t i = 0; i < threads; ++i)
-        workers.emplace_back(
-            [this]
-            {
-                for(;;)
-                {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-
-                    task();
-                }
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i)
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    for (size_t i = 0; i < threads; ++i)
+        workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+inline size_t ThreadPool::submit_queue()
+{
+    const WorkerSlot& slot = current_worker();
+    if (slot.pool == this) return slot.index;
+    return next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+}
+
+inline std::unique_lock<std::mutex> ThreadPool::lock_queue(WorkerQueue& queue)
+{
+    std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        if (PoolStats* pool_stats = stats.load(std::memory_order_relaxed)) pool_stats->contended_locks.fetch_add(1);
+        lock.lock();
+    }
+    return lock;
+}
+
+inline void ThreadPool::count_queued(size_t added, TaskPriority priority)
+{
+    if (priority == TaskPriority::High) pending_high.fetch_add(added);
+    size_t queued_now = pending.fetch_add(added) + added;
+    if (PoolStats* pool_stats = stats.load(std::memory_order_relaxed)) pool_stats->note_queued(queued_now);
+}
+
+inline void ThreadPool::notify(size_t added)
+{
+    // A worker counts itself as sleeping under sleep_mutex before it checks `pending`, so taking the
+    // mutex here guarantees it either sees the new tasks or is already waiting for this notification.
+    if (sleeping.load() > 0) {
+        { std::lock_guard<std::mutex> lock(sleep_mutex); }
+        if (added == 1) wake.notify_one();
+        else wake.notify_all();
+    }
+}
+
+inline bool ThreadPool::pop_from(size_t self, TaskPriority priority, PoolTask& task)
+{
+    {
+        std::unique_lock<std::mutex> lock = lock_queue(*queues[self]);
+        if (queues[self]->ring(priority).pop_front(task)) return true;
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        WorkerQueue& victim = *queues[(self + i) % queues.size()];
+        std::unique_lock<std::mutex> lock = lock_queue(victim);
+        if (victim.ring(priority).pop_back(task)) {
+            if (PoolStats* pool_stats = stats.load(std::memory_order_relaxed)) pool_stats->steals.fetch_add(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool ThreadPool::try_pop(size_t self, PoolTask& task)
+{
+    if (pending_high.load() > 0 && pop_from(self, TaskPriority::High, task)) {
+        pending_high.fetch_sub(1);
+        return true;
+    }
+    return pop_from(self, TaskPriority::Normal, task);
+}
+
+inline void ThreadPool::worker_loop(size_t index)
+{
+    current_worker() = {this, index};
+    for (;;) {
+        PoolTask task;
+        if (try_pop(index, task)) {
+            pending.fetch_sub(1);
+            PoolStats* pool_stats = stats.load(std::memory_order_relaxed);
+            if (!pool_stats) {
+                task();
+                continue;
             }
-        );
+            // `running` brackets every record of the task: a pool with none running has recorded each task
+            // it started, even though a task signals its completion before its run time is recorded.
+            pool_stats->running.fetch_add(1);
+            uint64_t started = stats_clock_ns();
+            if (task.queued_at != 0) pool_stats->wait.record(started - task.queued_at);
+            task();
+            pool_stats->run.record(stats_clock_ns() - started);
+            pool_stats->running.fetch_sub(1);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleeping.fetch_add(1);
+        wake.wait(lock, [this] { return stop.load() || pending.load() > 0; });
+        sleeping.fetch_sub(1);
+        // Queued work is still run after the pool is told to stop.
+        if (stop.load() && pending.load() == 0) return;
+    }
 }
 
 // Add new work item to the pool
 template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args) 
+auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type>
 {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
-        
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+    // The packaged_task is moved into the queue itself; only the future's shared state is allocated.
+    std::packaged_task<return_type()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<return_type> res = task.get_future();
 
-        // Don't allow enqueueing after stopping the pool
-        if(stop)
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+    // Don't allow enqueueing after stopping the pool
+    if (stop.load())
+        throw std::runtime_error("enqueue on stopped ThreadPool");
 
-        tasks.emplace([task](){ (*task)(); });
+    PoolTask queued(std::move(task));
+    queued.queued_at = queue_stamp();
+    WorkerQueue& queue = *queues[submit_queue()];
+    {
+        std::unique_lock<std::mutex> lock = lock_queue(queue);
+        queue.normal.push_back(std::move(queued));
+        count_queued(1, TaskPriority::Normal);
     }
-    condition.notify_one();
+    notify(1);
     return res;
 }
 
+template<class F>
+void ThreadPool::post(F&& f, TaskPriority priority)
+{
+    if (stop.load())
+        throw std::runtime_error("post on stopped ThreadPool");
+
+    PoolTask queued(std::forward<F>(f));
+    queued.queued_at = queue_stamp();
+    WorkerQueue& queue = *queues[submit_queue()];
+    {
+        std::unique_lock<std::mutex> lock = lock_queue(queue);
+        queue.ring(priority).push_back(std::move(queued));
+        count_queued(1, priority);
+    }
+    notify(1);
+}
+
+template<class F>
+BulkHandle ThreadPool::submit_bulk(size_t count, F&& fn, StopToken* token, TaskPriority priority)
+{
+    if (stop.load())
+        throw std::runtime_error("submit_bulk on stopped ThreadPool");
+
+    BulkHandle handle;
+    handle.state = std::make_shared<BulkHandle::State>();
+    handle.state->fn = std::forward<F>(fn);
+    handle.state->stop = token;
+    handle.state->remaining = count;
+    if (count == 0) return handle;
+
+    // One share of the tasks per worker, so they all start at once. A task runs whichever index is next, not a
+    // fixed one, so the batch is worked through in index order.
+    const size_t slices = std::min(count, queues.size());
+    const size_t first_queue = submit_queue();
+    const uint64_t queued_at = queue_stamp();
+    size_t begin = 0;
+    for (size_t s = 0; s < slices; ++s) {
+        size_t end = begin + count / slices + (s < count % slices ? 1 : 0);
+        WorkerQueue& queue = *queues[(first_queue + s) % queues.size()];
+        {
+            std::unique_lock<std::mutex> lock = lock_queue(queue);
+            for (size_t i = begin; i < end; ++i) {
+                std::shared_ptr<BulkHandle::State> state = handle.state;
+                PoolTask task([state] { state->run(state->next_index.fetch_add(1)); });
+                task.queued_at = queued_at;
+                queue.ring(priority).push_back(std::move(task));
+            }
+            count_queued(end - begin, priority);
+        }
+        begin = end;
+    }
+    notify(count);
+    return handle;
+}
+
 // The destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::lock_guard<std::mutex> lock(sleep_mutex);
         stop = true;
     }
-    condition.notify_all();
-    for(std::thread &worker: workers)
+    wake.notify_all();
+    for (std::thread& worker : workers)
         worker.join();
 }
 
-#endif // THREAD_POOL_HPP
\ No newline at end of file
+#endif // THREAD_POOL_HPP
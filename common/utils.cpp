@@ -1,5 +1,8 @@
 #include "utils.hpp"
 #include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <zlib.h>
 
 std::string decode_asciiz(const char* buffer, size_t max_len) {
     // Find the actual length of the null-terminated string
@@ -52,6 +55,64 @@ std::vector<std::string> split_string(const std::string& s, char delimiter) {
     return tokens;
 }
 
+void RawFingerprint::update(const void* data, size_t size) {
+    const Bytef* p = static_cast<const Bytef*>(data);
+    crc = static_cast<uint32_t>(crc32_z(crc, p, size));
+    adler = static_cast<uint32_t>(adler32_z(adler, p, size));
+}
+
+uint64_t parse_count(const std::string& s) {
+    if (s.empty() || !std::all_of(s.begin(), s.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+        throw std::invalid_argument("Invalid count '" + s + "'");
+    return std::stoull(s);
+}
+
+int parse_int(const std::string& s) {
+    size_t start = !s.empty() && s[0] == '-' ? 1 : 0;
+    if (s.size() == start || !std::all_of(s.begin() + start, s.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+        throw std::invalid_argument("Invalid number '" + s + "'");
+    return std::stoi(s);
+}
+
+uint64_t parse_byte_size(const std::string& s) {
+    size_t digits = 0;
+    while (digits < s.size() && std::isdigit(static_cast<unsigned char>(s[digits]))) ++digits;
+    if (digits == 0) throw std::invalid_argument("Invalid size '" + s + "'");
+
+    uint64_t shift = 0;
+    std::string suffix = s.substr(digits);
+    if (suffix == "K" || suffix == "k") shift = 10;
+    else if (suffix == "M" || suffix == "m") shift = 20;
+    else if (suffix == "G" || suffix == "g") shift = 30;
+    else if (!suffix.empty()) throw std::invalid_argument("Invalid size suffix in '" + s + "'");
+
+    uint64_t value = std::stoull(s.substr(0, digits));
+    if (value > (UINT64_MAX >> shift)) throw std::out_of_range("Size '" + s + "' is too large");
+    return value << shift;
+}
+
+bool glob_match(const std::string& pattern, const std::string& text) {
+    size_t p = 0, t = 0;
+    // Position of the last '*' seen and the text position it is currently matched up to, for backtracking.
+    size_t star = std::string::npos, star_t = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            star_t = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++star_t;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
 std::vector<char> read_filepath(const std::filesystem::path& path) {
     std::ifstream file(path, std::ios::binary | std::ios::ate);
     if (!file) {
@@ -30,6 +30,28 @@ std::vector<uint8_t> unhexlify(const std::string& hex_str);
 // Splits a string by a delimiter.
 std::vector<std::string> split_string(const std::string& s, char delimiter);
 
+// Fast fingerprint of a chunk's raw data: CRC-32 in the high half, Adler-32 in the low half.
+// Recorded at extract time so repack can tell which chunks are unchanged.
+class RawFingerprint {
+public:
+    void update(const void* data, size_t size);
+    uint64_t value() const { return (static_cast<uint64_t>(crc) << 32) | adler; }
+
+private:
+    uint32_t crc = 0;
+    uint32_t adler = 1;
+};
+
+// Parses a plain decimal count. Anything but digits, including a sign, is rejected.
+uint64_t parse_count(const std::string& s);
+// Parses a plain decimal int with an optional leading '-'. Anything else, including trailing characters, is rejected.
+int parse_int(const std::string& s);
+// Parses a byte count with an optional K, M or G (binary) suffix, e.g. "512M".
+uint64_t parse_byte_size(const std::string& s);
+
+// Matches a shell-style wildcard pattern ('*' and '?') against the whole of `text`.
+bool glob_match(const std::string& pattern, const std::string& text);
+
 // Reads the entire content of a file into a vector of chars.
 std::vector<char> read_filepath(const std::filesystem::path& path);
 
@@ -2,7 +2,10 @@
 #include <md5.hpp>
 #include <thread_pool.hpp>
 #include <zlib.h>
-#include <zstd.h>
+#include "chunk_encoder.hpp"
+#include "repack_plan.hpp"
+#include "byte_scan.hpp"
+#include "chunk_decoder.hpp"
 #include <algorithm>
 #include <iomanip>
 #include <fstream>
@@ -13,64 +16,249 @@
 #include <ctime>
 #include <thread>
 #include <future>
+#include <deque>
+#include <atomic>
+#include <optional>
+#include <memory>
+#include <condition_variable>
+#include <exception>
 
-std::vector<char> DzBuilder::compress_data(const std::vector<char> &input) const
+std::vector<char> DzBuilder::md5_hash(const void *data, size_t size) const
 {
-    std::string comp_type = meta["compression"];
-    std::vector<char> compressed_data;
+    MD5 hasher;
+    hasher.update(static_cast<const unsigned char *>(data), size);
+    hasher.finalize();
+    auto raw_digest = hasher.get_raw_digest();
+    return std::vector<char>(raw_digest.begin(), raw_digest.end());
+}
 
-    if (comp_type == "zlib")
+void DzBuilder::compress_chunk(const char *data, uint32_t size, ThreadPool &pool, const StopToken &stop,
+                               CompressedChunk &compressed, PartitionStats *stats)
+{
+    StageTimer deflate_timer(stats, Stage::Deflate);
+    if (codec.compression == "zlib" && codec.zlib_block_size != 0 && size > codec.zlib_block_size)
+        deflate_parallel(data, size, pool, stop, compressed.data);
+    else
+        ChunkEncoder::for_this_thread().compress(codec, data, size, compressed.data);
+    deflate_timer.done(size, compressed.data.size());
+
+    StageTimer md5_timer(stats, Stage::Md5);
+    compressed.md5 = md5_hash(compressed.data.data(), compressed.data.size());
+    md5_timer.done(compressed.data.size(), compressed.md5.size());
+
+    StageTimer crc_timer(stats, Stage::Crc);
+    compressed.crc = crc32(0L, reinterpret_cast<const Bytef *>(compressed.data.data()), compressed.data.size());
+    crc_timer.done(compressed.data.size(), sizeof(compressed.crc));
+}
+
+void DzBuilder::deflate_parallel(const char *data, uint32_t size, ThreadPool &pool, const StopToken &stop,
+                                 std::vector<char> &output)
+{
+    // Shared with the helper tasks, which may only get to run after this chunk is done.
+    struct SplitState
     {
-        z_stream strm = {};
-        if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK)
-        {
-            throw std::runtime_error("zlib deflateInit failed");
-        }
-        uLong bound = deflateBound(&strm, input.size());
-        compressed_data.resize(bound);
-        strm.avail_in = input.size();
-        strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
-        strm.avail_out = compressed_data.size();
-        strm.next_out = reinterpret_cast<Bytef *>(compressed_data.data());
-
-        if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+        const char *data;
+        uint32_t size;
+        const StopToken *stop;
+        uint32_t block_size;
+        size_t block_count;
+        std::vector<std::vector<char>> blocks;
+        std::vector<uLong> adlers;
+        std::atomic<size_t> next_block{0};
+        std::mutex done_mutex;
+        std::condition_variable done_cv;
+        size_t done_blocks = 0;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<SplitState>();
+    state->data = data;
+    state->size = size;
+    state->stop = &stop;
+    state->block_size = codec.zlib_block_size;
+    state->block_count = (size + codec.zlib_block_size - 1) / codec.zlib_block_size;
+    state->blocks.resize(state->block_count);
+    state->adlers.resize(state->block_count);
+
+    // Claims blocks until none are left. A block is only claimed by a running thread, so waiting for the
+    // claimed ones cannot deadlock even when every pool worker is busy.
+    auto run = [this](SplitState &st)
+    {
+        for (size_t i = st.next_block++; i < st.block_count; i = st.next_block++)
         {
-            deflateEnd(&strm);
-            throw std::runtime_error("zlib deflate failed");
+            try
+            {
+                st.stop->throw_if_stopped();
+                uint64_t begin = static_cast<uint64_t>(i) * st.block_size;
+                size_t length = static_cast<size_t>(std::min<uint64_t>(st.block_size, st.size - begin));
+                size_t dict_size = static_cast<size_t>(std::min<uint64_t>(begin, 32 * 1024));
+                ChunkEncoder::for_this_thread().deflate_block(codec, st.data + begin, length, dict_size,
+                                                              i + 1 == st.block_count, st.blocks[i]);
+                st.adlers[i] = adler32_z(1L, reinterpret_cast<const Bytef *>(st.data + begin), length);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(st.done_mutex);
+                if (!st.error)
+                    st.error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(st.done_mutex);
+            if (++st.done_blocks == st.block_count)
+                st.done_cv.notify_all();
         }
-        compressed_data.resize(strm.total_out);
-        deflateEnd(&strm);
+    };
+    size_t helpers = std::min(state->block_count - 1, pool.size());
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        pool.enqueue([state, run] { run(*state); });
     }
-    else if (comp_type == "zstd")
+    run(*state);
     {
-        size_t bound = ZSTD_compressBound(input.size());
-        compressed_data.resize(bound);
-        size_t compressed_size = ZSTD_compress(compressed_data.data(), bound, input.data(), input.size(), ZSTD_CLEVEL_DEFAULT);
-        if (ZSTD_isError(compressed_size))
-        {
-            throw std::runtime_error("zstd compression failed: " + std::string(ZSTD_getErrorName(compressed_size)));
-        }
-        compressed_data.resize(compressed_size);
+        std::unique_lock<std::mutex> lock(state->done_mutex);
+        state->done_cv.wait(lock, [&] { return state->done_blocks == state->block_count; });
+        if (state->error)
+            std::rethrow_exception(state->error);
     }
-    else
+
+    // zlib header, the raw deflate blocks in order, then the Adler-32 of the whole chunk, big-endian.
+    output = zlib_stream_header(codec.level.value_or(Z_DEFAULT_COMPRESSION));
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (size_t i = 0; i < state->block_count; ++i)
+    {
+        output.insert(output.end(), state->blocks[i].begin(), state->blocks[i].end());
+        uint64_t length = std::min<uint64_t>(state->block_size, size - static_cast<uint64_t>(i) * state->block_size);
+        adler = adler32_combine(adler, state->adlers[i], static_cast<z_off_t>(length));
+    }
+    for (int shift = 24; shift >= 0; shift -= 8)
     {
-        throw std::runtime_error("Unknown compression type: " + comp_type);
+        output.push_back(static_cast<char>((adler >> shift) & 0xff));
     }
-    return compressed_data;
 }
 
-std::vector<char> DzBuilder::md5_hash(const void *data, size_t size) const
+const CompressedChunk &DzBuilder::uniform_chunk(const char *data, uint32_t size, uint8_t value, ThreadPool &pool,
+                                                const StopToken &stop, PartitionStats *stats)
 {
+    const auto key = std::make_pair(size, value);
+    {
+        std::lock_guard<std::mutex> lock(uniform_mutex);
+        auto it = uniform_chunks.find(key);
+        if (it != uniform_chunks.end())
+            return it->second;
+    }
+
+    // Compressed outside the lock. Two workers may race on the same key; both produce identical bytes.
+    CompressedChunk compressed;
+    compress_chunk(data, size, pool, stop, compressed, stats);
+
+    std::lock_guard<std::mutex> lock(uniform_mutex);
+    return uniform_chunks.emplace(key, std::move(compressed)).first->second;
+}
+
+// Returns the compressed data stored for `chunk` in the source KDZ, with its MD5 and CRC, or nothing when
+// the source does not hold that chunk. The compressed bytes must match the MD5 (and, for v1 headers, the CRC)
+// recorded at extraction, so a source that was modified since is never copied from. Only the data is taken
+// from the source: the caller builds the header from the plan, so edits to metadata.json are kept.
+static std::optional<CompressedChunk> source_chunk(const MappedFile &source, const RepackChunk &chunk, bool is_v0)
+{
+    if (!chunk.has_hash)
+        return std::nullopt;
+
+    // The header sits right before the data; check it still describes this chunk before trusting it.
+    const size_t header_size = is_v0 ? sizeof(DzChunkHeaderV0) : sizeof(DzChunkHeaderV1);
+    if (chunk.file_offset < header_size || chunk.file_offset + chunk.file_size > source.size())
+        return std::nullopt;
+    const uint8_t *header = source.data() + chunk.file_offset - header_size;
+    DzChunkHeaderV0 common{};
+    std::memcpy(&common, header, sizeof(common));
+    // The names are compared as the fixed-size fields of the header, padding included.
+    static_assert(sizeof(common.part_name) == sizeof(chunk.part_name) && sizeof(common.chunk_name) == sizeof(chunk.chunk_name),
+                  "RepackChunk names must match the chunk header fields");
+    if (common.magic != DZ_PART_MAGIC || common.compressed_size != chunk.file_size ||
+        common.decompressed_size != chunk.data_size ||
+        std::memcmp(common.part_name, chunk.part_name, sizeof(chunk.part_name)) != 0 ||
+        std::memcmp(common.chunk_name, chunk.chunk_name, sizeof(chunk.chunk_name)) != 0)
+        return std::nullopt;
+
+    if (std::memcmp(common.hash, chunk.hash, sizeof(chunk.hash)) != 0)
+        return std::nullopt;
+    const uint8_t *data = header + header_size;
     MD5 hasher;
-    hasher.update(static_cast<const unsigned char *>(data), size);
+    hasher.update(data, chunk.file_size);
     hasher.finalize();
-    auto raw_digest = hasher.get_raw_digest();
-    return std::vector<char>(raw_digest.begin(), raw_digest.end());
+    if (std::memcmp(hasher.get_raw_digest().data(), chunk.hash, sizeof(chunk.hash)) != 0)
+        return std::nullopt;
+    uint32_t crc = crc32(0L, reinterpret_cast<const Bytef *>(data), chunk.file_size);
+    if (!is_v0)
+    {
+        DzChunkHeaderV1 v1{};
+        std::memcpy(&v1, header, sizeof(v1));
+        if (v1.crc != chunk.crc || crc != chunk.crc)
+            return std::nullopt;
+    }
+
+    CompressedChunk copied;
+    copied.data.assign(reinterpret_cast<const char *>(data), reinterpret_cast<const char *>(data) + chunk.file_size);
+    copied.md5.assign(chunk.hash, chunk.hash + sizeof(chunk.hash));
+    copied.crc = crc;
+    return copied;
 }
 
-std::vector<char> DzBuilder::build(const std::filesystem::path &input_dir, ThreadPool& pool)
+// Returns the source KDZ's copy of `chunk`, or nothing when the image data no longer matches the chunk's
+// raw_fingerprint or the source does not hold that chunk.
+static std::optional<CompressedChunk> reuse_source_chunk(const MappedFile &source, const RepackChunk &chunk, bool is_v0,
+                                                         const char *data, size_t size)
 {
-    std::cout << "Building DZ file..." << std::endl;
+    if (!chunk.has_fingerprint)
+        return std::nullopt;
+    RawFingerprint fingerprint;
+    fingerprint.update(data, size);
+    if (fingerprint.value() != chunk.raw_fingerprint)
+        return std::nullopt;
+    return source_chunk(source, chunk, is_v0);
+}
+
+// The chunk header for `compressed`, with every other field taken from the plan.
+static std::vector<char> chunk_header(const RepackChunk &chunk, const RepackPartition &partition, bool is_v0,
+                                      const CompressedChunk &compressed)
+{
+    std::vector<char> chunk_header_data;
+    if (is_v0)
+    {
+        DzChunkHeaderV0 header{};
+        header.magic = DZ_PART_MAGIC;
+        std::memcpy(header.part_name, chunk.part_name, sizeof(header.part_name));
+        std::memcpy(header.chunk_name, chunk.chunk_name, sizeof(header.chunk_name));
+        header.decompressed_size = chunk.data_size;
+        header.compressed_size = compressed.data.size();
+        std::memcpy(header.hash, compressed.md5.data(), sizeof(header.hash));
+        chunk_header_data.assign(reinterpret_cast<char *>(&header), reinterpret_cast<char *>(&header) + sizeof(header));
+    }
+    else // v1
+    {
+        DzChunkHeaderV1 header{};
+        header.magic = DZ_PART_MAGIC;
+        std::memcpy(header.part_name, chunk.part_name, sizeof(header.part_name));
+        std::memcpy(header.chunk_name, chunk.chunk_name, sizeof(header.chunk_name));
+        header.decompressed_size = chunk.data_size;
+        header.compressed_size = compressed.data.size();
+        std::memcpy(header.hash, compressed.md5.data(), sizeof(header.hash));
+        header.start_sector = chunk.start_sector;
+        header.sector_count = chunk.sector_count;
+        header.hw_partition = partition.hw_part;
+        header.crc = compressed.crc;
+        header.unique_part_id = chunk.unique_part_id;
+        header.is_sparse = chunk.is_sparse;
+        header.is_ubi_image = chunk.is_ubi_image;
+        header.part_start_sector = chunk.part_start_sector;
+        std::memset(header.padding, 0, sizeof(header.padding));
+        chunk_header_data.assign(reinterpret_cast<char *>(&header), reinterpret_cast<char *>(&header) + sizeof(header));
+    }
+    return chunk_header_data;
+}
+
+uint64_t DzBuilder::build(const std::filesystem::path &input_dir, Executors& executors, std::iostream& out)
+{
+    ThreadPool &pool = executors.compute;
+    std::cout << "Building DZ file (" << codec.describe() << ")..." << std::endl;
 
     // Stage 1: Processing and compressing all partition chunks
     std::cout << "  Stage 1: Processing and compressing all partition chunks..." << std::endl;
@@ -78,151 +266,335 @@ std::vector<char> DzBuilder::build(const std::filesystem::path &input_dir, Threa
     // A struct to hold the return type from a chunk processing task
     using ChunkResult = std::pair<std::vector<char>, std::vector<char>>; // {header, data}
 
-    // A struct to hold all information needed to process one chunk
-    struct ChunkTaskInfo
+    // metadata.json is parsed once; the workers only see the typed plan.
+    const MappedFile *decode_source = options.decode_source;
+    const RepackPlan plan = RepackPlan::from_metadata(meta, input_dir);
+
+    // One shared reader per partition image; positional reads need no per-task handle.
+    // Partitions without an image get none; their chunks come from the source KDZ.
+    std::vector<std::unique_ptr<PositionalReader>> images(plan.partitions.size());
+    for (size_t i = 0; i < plan.partitions.size(); ++i)
     {
-        size_t task_index;
-        int hw_part;
-        std::string pname;
-        json chunk_meta;
-        std::filesystem::path img_filename;
-        size_t chunk_of_total; // For logging (e.g., "chunk 3/10")
-    };
+        if (!decode_source && plan.partitions[i].has_image)
+            images[i] = std::make_unique<PositionalReader>(plan.partitions[i].image_path);
+    }
 
-    // --- Task Collection Phase (Sequential) ---
-    std::vector<ChunkTaskInfo> tasks_to_process;
-    size_t total_chunk_count = meta["part_count"].get<size_t>();
-    size_t current_chunk_index = 0;
+    bool is_v0 = meta["minor"] == 0;
 
-    for (auto const &[hw_part_str, parts] : meta["parts"].items())
+    // Original chunks are only reused when the requested codec is the one they were compressed with.
+    const MappedFile *source = options.source;
+    CodecParams source_codec;
+    source_codec.compression = options.source_compression.empty() ? codec.compression : options.source_compression;
+    if (source && !(codec == source_codec))
     {
-        int hw_part = std::stoi(hw_part_str);
-        for (auto const &[pname, chunks] : parts.items())
+        std::cout << "  Chunks are requested as " << codec.describe() << " but " << source->path().string()
+                  << " holds " << source_codec.describe() << "; recompressing every chunk instead of reusing them."
+                  << std::endl;
+        source = nullptr;
+    }
+    // Partitions left out of an --only/--exclude extraction have no image, so their chunks can only be copied
+    // from the source KDZ. Without one, fail before anything is written.
+    std::vector<const RepackPartition *> missing = decode_source ? std::vector<const RepackPartition *>() : plan.missing_images();
+    if (!missing.empty() && !source)
+    {
+        std::string names;
+        for (const RepackPartition *partition : missing)
+            names += (names.empty() ? "" : ", ") + partition->image_path.filename().string();
+        throw std::runtime_error("ERROR: " + std::to_string(missing.size()) + " partition image(s) not found in '" +
+                                 input_dir.string() + "': " + names + ". Their chunks can only be copied from the KDZ "
+                                 "the folder was extracted from: pass it with --source (without --no-reuse, and with "
+                                 "the codec it was built with), or extract those partitions too.");
+    }
+    std::atomic<size_t> reused_chunks{0};
+    std::atomic<size_t> copied_chunks{0};
+    ChunkCache *cache = options.cache;
+    // Triggered by the first chunk that fails, or by the writer.
+    StopToken stop;
+    // Stage counters by partition index, while --stats is collecting.
+    std::vector<PartitionStats *> part_stats(plan.partitions.size(), nullptr);
+    if (executors.stats)
+    {
+        for (size_t i = 0; i < plan.partitions.size(); ++i)
+            part_stats[i] = &executors.stats->partition(plan.partitions[i].hw_part, plan.partitions[i].name);
+    }
+
+    // Raw chunk data is handed from the I/O stage to the compute stage in these buffers. They are recycled,
+    // and there are never more of them than chunks in flight.
+    std::mutex spare_mutex;
+    std::vector<std::vector<char>> spare_buffers;
+    auto take_buffer = [&]()
+    {
+        std::lock_guard<std::mutex> lock(spare_mutex);
+        if (spare_buffers.empty())
+            return std::vector<char>();
+        std::vector<char> buffer = std::move(spare_buffers.back());
+        spare_buffers.pop_back();
+        return buffer;
+    };
+    auto recycle_buffer = [&](std::vector<char> &&buffer)
+    {
+        std::lock_guard<std::mutex> lock(spare_mutex);
+        spare_buffers.push_back(std::move(buffer));
+    };
+
+    // I/O stage: reads the chunk's raw data from its partition image into `buffer` and returns the number of
+    // bytes that came from the disk. Holes in sparse images are zero-filled without touching the disk; a chunk
+    // that lies entirely in a hole reads 0 bytes. When transcoding, it faults the compressed source chunk in
+    // instead, so the decoder does not wait for the disk.
+    auto read_chunk = [&plan, &images, &part_stats, decode_source](size_t chunk_index, std::vector<char> &buffer) -> uint64_t
         {
-            auto img_filename = input_dir / (std::to_string(hw_part) + "." + pname + ".img");
-            if (!std::filesystem::exists(img_filename))
+            const RepackChunk &chunk = plan.chunks[chunk_index];
+            if (!images[chunk.partition] && !decode_source)
+                return 0;
+            StageTimer read_timer(part_stats[chunk.partition], Stage::Read);
+            if (decode_source)
             {
-                throw std::runtime_error("ERROR: Image file not found: " + img_filename.string());
+                decode_source->prefetch(chunk.file_offset, chunk.file_size);
+                read_timer.done(chunk.file_size, chunk.file_size);
+                return 0;
             }
+            buffer.resize(chunk.data_size);
+            uint64_t bytes_read = images[chunk.partition]->read_at(buffer.data(), chunk.data_size, chunk.image_offset);
+            read_timer.done(chunk.data_size, bytes_read);
+            return bytes_read;
+        };
+
+    // Compute stage: builds one chunk from the data read by the I/O stage. Long-running steps check `stop`.
+    auto build_chunk = [this, &pool, &plan, &part_stats, decode_source, is_v0, source, cache, &reused_chunks, &copied_chunks, &stop](
+                           size_t chunk_index, std::vector<char> &decompressed_data, uint64_t bytes_read)
+        {
+            const RepackChunk &chunk = plan.chunks[chunk_index];
+            const RepackPartition &partition = plan.partitions[chunk.partition];
+            PartitionStats *stats = part_stats[chunk.partition];
 
-            for (const auto &chunk : chunks)
+            // Print progress in a thread-safe manner
             {
-                tasks_to_process.push_back({
-                    current_chunk_index++,
-                    hw_part,
-                    pname,
-                    chunk,
-                    img_filename,
-                    chunks.size()
-                });
+                std::lock_guard<std::mutex> lock(cout_mutex);
+                std::cout << "    Processing hw_part " << partition.hw_part
+                          << ", partition '" << partition.name
+                          << "', chunk '" << decode_asciiz(chunk.chunk_name, sizeof(chunk.chunk_name)) << "'..." << std::endl;
             }
-        }
-    }
-
-    std::vector<std::future<ChunkResult>> future_results;
-    future_results.reserve(total_chunk_count);
 
-    bool is_v0 = meta["minor"] == 0;
-
-    for (const auto &task_info : tasks_to_process)
-    {
-        future_results.emplace_back(
-            pool.enqueue([this, task_info, is_v0]
+            uint32_t size = chunk.data_size;
+            if (!decode_source && !partition.has_image)
             {
-                // This lambda is the task executed by a worker thread.
-
-                // Print progress in a thread-safe manner
+                auto copied = source_chunk(*source, chunk, is_v0);
+                if (!copied)
+                    throw std::runtime_error("Chunk '" + decode_asciiz(chunk.chunk_name, sizeof(chunk.chunk_name)) +
+                                             "' of partition '" + partition.name + "', which has no image, is not in " +
+                                             source->path().string() + " or no longer matches its recorded MD5/CRC");
+                ++copied_chunks;
+                return std::make_pair(chunk_header(chunk, partition, is_v0, *copied), std::move(copied->data));
+            }
+            if (decode_source)
+            {
+                // Transcoding: the raw data comes straight out of the source chunk, once its MD5 matches the header.
+                decompressed_data.resize(size);
+                bytes_read = 0;
+                const uint8_t *in_data = decode_source->slice(chunk.file_offset, chunk.file_size);
+                if (chunk.has_hash)
                 {
-                    std::lock_guard<std::mutex> lock(cout_mutex);
-                    std::cout << "    Processing hw_part " << task_info.hw_part 
-                              << ", partition '" << task_info.pname 
-                              << "', chunk '" << task_info.chunk_meta["name"].get<std::string>() << "'..." << std::endl;
+                    StageTimer md5_timer(stats, Stage::Md5);
+                    MD5 hasher;
+                    hasher.update(in_data, chunk.file_size);
+                    hasher.finalize();
+                    std::vector<uint8_t> digest = hasher.get_raw_digest();
+                    md5_timer.done(chunk.file_size, digest.size());
+                    if (std::memcmp(digest.data(), chunk.hash, sizeof(chunk.hash)) != 0)
+                        throw std::runtime_error("Chunk hash mismatch in partition " + std::to_string(partition.hw_part) + "." +
+                                                 partition.name + ", chunk '" +
+                                                 decode_asciiz(chunk.chunk_name, sizeof(chunk.chunk_name)) + "' at offset " +
+                                                 std::to_string(chunk.file_offset) + ": expected " +
+                                                 bytes_to_hex(chunk.hash, sizeof(chunk.hash)) + ", got " + bytes_to_hex(digest));
                 }
-                
-                // Read the specific part of the image file for this chunk.
-                // Note: ifstream is not inherently thread-safe, but each thread creates its own instance,
-                // and the OS handles concurrent reads from a single file. This is generally safe and performant.
-                std::ifstream f_img(task_info.img_filename, std::ios::binary);
-                if (!f_img) {
-                    throw std::runtime_error("Failed to open image file in thread: " + task_info.img_filename.string());
+                StageTimer inflate_timer(stats, Stage::Inflate);
+                ChunkDecoder::for_this_thread().decompress(options.decode_compression, in_data, chunk.file_size, size,
+                    [&](const char *data, size_t data_size)
+                    {
+                        if (bytes_read + data_size > size)
+                            throw std::runtime_error("Chunk '" + decode_asciiz(chunk.chunk_name, sizeof(chunk.chunk_name)) +
+                                                     "' decompresses to more than its data_size");
+                        std::memcpy(decompressed_data.data() + bytes_read, data, data_size);
+                        bytes_read += data_size;
+                    }, &stop);
+                inflate_timer.done(chunk.file_size, bytes_read);
+                decode_source->advise(chunk.file_offset, chunk.file_size, MappedFile::Advice::DontNeed);
+                if (bytes_read != size)
+                    throw std::runtime_error("Chunk '" + decode_asciiz(chunk.chunk_name, sizeof(chunk.chunk_name)) +
+                                             "' decompresses to " + std::to_string(bytes_read) + " bytes, expected " +
+                                             std::to_string(size));
+            }
+
+            if (source)
+            {
+                auto reused = reuse_source_chunk(*source, chunk, is_v0, decompressed_data.data(), size);
+                if (reused)
+                {
+                    ++reused_chunks;
+                    return std::make_pair(chunk_header(chunk, partition, is_v0, *reused), std::move(reused->data));
                 }
+            }
 
-                uint64_t offset = (task_info.chunk_meta["start_sector"].get<uint64_t>() - task_info.chunk_meta["part_start_sector"].get<uint64_t>()) * 4096;
-                uint32_t size = task_info.chunk_meta["data_size"];
-                
-                f_img.seekg(offset);
-                std::vector<char> decompressed_data(size);
-                f_img.read(decompressed_data.data(), size);
-                f_img.close();
+            CompressedChunk compressed;
+            std::string cache_key;
+            bool resolved = false;
+            uint8_t fill_byte = 0;
+            if ((bytes_read == 0 && size > 0) ||
+                is_uniform_byte(reinterpret_cast<const uint8_t *>(decompressed_data.data()), size, fill_byte))
+            {
+                compressed = this->uniform_chunk(decompressed_data.data(), size, fill_byte, pool, stop, stats);
+                resolved = true;
+            }
+            else if (cache)
+            {
+                cache_key = ChunkCache::key_for(this->codec, decompressed_data.data(), size);
+                resolved = cache->load(cache_key, size, compressed);
+            }
+            if (!resolved)
+            {
+                // Not a uniform chunk and not in the cache
+                this->compress_chunk(decompressed_data.data(), size, pool, stop, compressed, stats);
+                if (cache)
+                    cache->store(cache_key, size, compressed);
+            }
 
-                std::vector<char> compressed_data = this->compress_data(decompressed_data);
-                auto data_md5_vec = this->md5_hash(compressed_data.data(), compressed_data.size());
+            return std::make_pair(chunk_header(chunk, partition, is_v0, compressed), std::move(compressed.data));
+        };
 
-                std::vector<char> chunk_header_data;
-                if (is_v0)
+    // Each chunk is read on the I/O executor, then compressed on the compute executor. Nothing touches the
+    // builder's state after the chunk's promise is fulfilled, since the writer may return right after.
+    auto submit = [&](size_t chunk_index)
+    {
+        auto result = std::make_shared<std::promise<ChunkResult>>();
+        std::future<ChunkResult> future = result->get_future();
+        executors.io.post([&, chunk_index, result]
+            {
+                try
                 {
-                    DzChunkHeaderV0 header{};
-                    header.magic = DZ_PART_MAGIC;
-                    auto part_name_vec = encode_asciiz(task_info.pname, sizeof(header.part_name));
-                    std::memcpy(header.part_name, part_name_vec.data(), sizeof(header.part_name));
-                    auto chunk_name_vec = encode_asciiz(task_info.chunk_meta["name"], sizeof(header.chunk_name));
-                    std::memcpy(header.chunk_name, chunk_name_vec.data(), sizeof(header.chunk_name));
-                    header.decompressed_size = size;
-                    header.compressed_size = compressed_data.size();
-                    std::memcpy(header.hash, data_md5_vec.data(), sizeof(header.hash));
-                    chunk_header_data.assign(reinterpret_cast<char *>(&header), reinterpret_cast<char *>(&header) + sizeof(header));
+                    // Chunks still queued when another one fails return right away.
+                    stop.throw_if_stopped();
+                    std::vector<char> buffer = take_buffer();
+                    uint64_t bytes_read = read_chunk(chunk_index, buffer);
+                    pool.post([&, chunk_index, result, bytes_read, buffer = std::move(buffer)]() mutable
+                        {
+                            try
+                            {
+                                stop.throw_if_stopped();
+                                ChunkResult built = build_chunk(chunk_index, buffer, bytes_read);
+                                recycle_buffer(std::move(buffer));
+                                result->set_value(std::move(built));
+                            }
+                            catch (...)
+                            {
+                                stop.request_stop(std::current_exception());
+                                result->set_exception(std::current_exception());
+                            }
+                        });
                 }
-                else // v1
+                catch (...)
                 {
-                    DzChunkHeaderV1 header{};
-                    header.magic = DZ_PART_MAGIC;
-                    auto part_name_vec = encode_asciiz(task_info.pname, sizeof(header.part_name));
-                    std::memcpy(header.part_name, part_name_vec.data(), sizeof(header.part_name));
-                    auto chunk_name_vec = encode_asciiz(task_info.chunk_meta["name"], sizeof(header.chunk_name));
-                    std::memcpy(header.chunk_name, chunk_name_vec.data(), sizeof(header.chunk_name));
-                    header.decompressed_size = task_info.chunk_meta["data_size"];
-                    header.compressed_size = compressed_data.size();
-                    std::memcpy(header.hash, data_md5_vec.data(), sizeof(header.hash));
-                    header.start_sector = task_info.chunk_meta["start_sector"];
-                    header.sector_count = task_info.chunk_meta["sector_count"];
-                    header.hw_partition = task_info.hw_part;
-                    header.crc = crc32(0L, reinterpret_cast<const Bytef *>(compressed_data.data()), compressed_data.size());
-                    header.unique_part_id = task_info.chunk_meta["unique_part_id"];
-                    header.is_sparse = task_info.chunk_meta["is_sparse"];
-                    header.is_ubi_image = task_info.chunk_meta["is_ubi_image"];
-                    header.part_start_sector = task_info.chunk_meta["part_start_sector"];
-                    std::memset(header.padding, 0, sizeof(header.padding));
-                    chunk_header_data.assign(reinterpret_cast<char *>(&header), reinterpret_cast<char *>(&header) + sizeof(header));
+                    stop.request_stop(std::current_exception());
+                    result->set_exception(std::current_exception());
                 }
+            });
+        return future;
+    };
 
-                return std::make_pair(std::move(chunk_header_data), std::move(compressed_data));
-            })
-        );
-    }
-    
-    // --- Result Collection Phase (Sequential to preserve order) ---
-    std::vector<std::vector<char>> chunk_headers_list(total_chunk_count);
-    std::vector<std::vector<char>> chunk_data_list(total_chunk_count);
+    // --- Streaming Phase (Sequential to preserve order) ---
+    // Chunks are written to `out` at their final offsets as soon as they are next in line. Only a window of
+    // tasks ahead of the writer is submitted, so the data held in memory is bounded by the window instead of
+    // growing to the size of the whole DZ. A slow chunk at the head of the window stalls submission.
+    const uint64_t dz_start = static_cast<uint64_t>(out.tellp());
+    DzMainHeader placeholder_header{};
+    out.write(reinterpret_cast<const char *>(&placeholder_header), sizeof(placeholder_header));
+
+    const size_t max_chunks = options.max_inflight_chunks > 0 ? options.max_inflight_chunks : std::max<size_t>(1, pool.size() * 2);
+    std::deque<std::future<ChunkResult>> in_flight;
+    std::deque<uint64_t> in_flight_sizes;
+    uint64_t in_flight_bytes = 0;
+    size_t next_to_submit = 0;
+
+    // The first chunk of an empty window is always admitted, so an oversized chunk cannot stall the build.
+    auto window_admits = [&](uint64_t chunk_bytes)
+    {
+        if (in_flight.empty())
+            return true;
+        if (in_flight.size() >= max_chunks)
+            return false;
+        return options.max_inflight_bytes == 0 || in_flight_bytes + chunk_bytes <= options.max_inflight_bytes;
+    };
+
+    MD5 chunk_hdrs_hasher;
+    try
+    {
+        for (size_t i = 0; i < plan.chunks.size(); ++i)
+        {
+            while (next_to_submit < plan.chunks.size())
+            {
+                uint64_t chunk_bytes = plan.chunks[next_to_submit].data_size;
+                if (!window_admits(chunk_bytes))
+                    break;
+                in_flight.push_back(submit(next_to_submit));
+                in_flight_sizes.push_back(chunk_bytes);
+                in_flight_bytes += chunk_bytes;
+                ++next_to_submit;
+            }
 
-    for (size_t i = 0; i < total_chunk_count; ++i)
+            // .get() will block until the future is ready.
+            ChunkResult result = in_flight.front().get();
+            in_flight.pop_front();
+            in_flight_bytes -= in_flight_sizes.front();
+            in_flight_sizes.pop_front();
+
+            chunk_hdrs_hasher.update(reinterpret_cast<const unsigned char *>(result.first.data()), result.first.size());
+            StageTimer write_timer(part_stats[plan.chunks[i].partition], Stage::Write);
+            out.write(result.first.data(), result.first.size());
+            out.write(result.second.data(), result.second.size());
+            if (!out)
+            {
+                throw std::runtime_error("Failed to write DZ data to the output file");
+            }
+            write_timer.done(result.first.size() + result.second.size(), result.first.size() + result.second.size());
+        }
+    }
+    catch (...)
+    {
+        // The outstanding tasks reference this builder, so they have to finish before the error propagates.
+        // With the stop token triggered, queued ones return at once and running ones give up at their next check.
+        stop.request_stop(std::current_exception());
+        // The one whose get() threw is no longer valid.
+        for (auto &pending : in_flight)
+        {
+            if (pending.valid())
+                pending.wait();
+        }
+        // Report the chunk that failed first rather than one that was cancelled because of it.
+        if (std::exception_ptr reason = stop.error())
+            std::rethrow_exception(reason);
+        throw;
+    }
+    const uint64_t dz_end = static_cast<uint64_t>(out.tellp());
+    if (source)
+    {
+        std::cout << "  Reused " << reused_chunks.load() << " of " << plan.chunks.size()
+                  << " chunks unchanged from " << source->path().string() << "." << std::endl;
+        if (copied_chunks > 0)
+            std::cout << "  Copied " << copied_chunks.load() << " chunks of partitions without an image from "
+                      << source->path().string() << "." << std::endl;
+    }
+    if (cache)
     {
-        // .get() will block until the future is ready.
-        // We iterate sequentially from 0 to N-1 to ensure the final lists are in the correct order.
-        ChunkResult result = future_results[i].get();
-        chunk_headers_list[i] = std::move(result.first);
-        chunk_data_list[i] = std::move(result.second);
+        std::cout << "  Chunk cache " << cache->dir().string() << ": " << cache->hits() << " hits, "
+                  << cache->misses() << " misses." << std::endl;
+        cache->trim();
     }
 
     // Stage 2: Calculating final hashes for the DZ header
     std::cout << "  Stage 2: Calculating final hashes for the DZ header..." << std::endl;
 
-    // Calculate chunk_hdrs_hash
-    std::vector<char> all_chunk_headers;
-    for (const auto &hdr : chunk_headers_list)
-    {
-        all_chunk_headers.insert(all_chunk_headers.end(), hdr.begin(), hdr.end());
-    }
-    auto chunk_hdrs_hash_vec = md5_hash(all_chunk_headers.data(), all_chunk_headers.size());
+    // The chunk_hdrs_hash was accumulated while streaming
+    chunk_hdrs_hasher.finalize();
+    auto chunk_hdrs_hash_vec = chunk_hdrs_hasher.get_raw_digest();
 
     // Prepare fields for header packing
     DzMainHeader proto_header{};
@@ -324,30 +696,46 @@ std::vector<char> DzBuilder::build(const std::filesystem::path &input_dir, Threa
     header_for_data_hash.header_crc = header_crc;
     std::memset(header_for_data_hash.data_hash, 0xFF, sizeof(header_for_data_hash.data_hash));
 
+    // The main header is hashed first but depends on every chunk header, so the rest of the
+    // data_hash comes from one sequential read back of the chunks that were just written.
+    PartitionStats *dz_stats = whole_dz_stats(executors);
     MD5 data_hasher;
     data_hasher.update(reinterpret_cast<const unsigned char *>(&header_for_data_hash), sizeof(header_for_data_hash));
-    for (size_t i = 0; i < chunk_headers_list.size(); ++i)
+    out.flush();
+    out.seekg(dz_start + sizeof(DzMainHeader));
+    std::vector<char> read_back(16 * 1024 * 1024);
+    for (uint64_t remaining = dz_end - dz_start - sizeof(DzMainHeader); remaining > 0;)
     {
-        data_hasher.update(reinterpret_cast<const unsigned char *>(chunk_headers_list[i].data()), chunk_headers_list[i].size());
-        data_hasher.update(reinterpret_cast<const unsigned char *>(chunk_data_list[i].data()), chunk_data_list[i].size());
+        size_t step = static_cast<size_t>(std::min<uint64_t>(remaining, read_back.size()));
+        StageTimer read_timer(dz_stats, Stage::Read);
+        if (!out.read(read_back.data(), step))
+        {
+            throw std::runtime_error("Failed to read back DZ data from the output file");
+        }
+        read_timer.done(step, step);
+        StageTimer md5_timer(dz_stats, Stage::Md5);
+        data_hasher.update(reinterpret_cast<const unsigned char *>(read_back.data()), step);
+        md5_timer.done(step, 0);
+        remaining -= step;
     }
     data_hasher.finalize();
     auto data_hash_digest_vec = data_hasher.get_raw_digest();
 
-    // Stage 3: Assembling the final DZ file
-    std::cout << "  Stage 3: Assembling the final DZ file..." << std::endl;
+    // Stage 3: Finalizing the DZ header
+    std::cout << "  Stage 3: Writing the final DZ header..." << std::endl;
     DzMainHeader final_header = proto_header;
     final_header.header_crc = header_crc;
     std::memcpy(final_header.data_hash, data_hash_digest_vec.data(), data_hash_digest_vec.size());
 
-    std::vector<char> dz_buffer;
-    dz_buffer.insert(dz_buffer.end(), reinterpret_cast<char *>(&final_header), reinterpret_cast<char *>(&final_header) + sizeof(final_header));
-    for (size_t i = 0; i < chunk_headers_list.size(); ++i)
+    // Patch the main header in place and leave the stream at the end of the DZ
+    out.seekp(dz_start);
+    out.write(reinterpret_cast<const char *>(&final_header), sizeof(final_header));
+    out.seekp(dz_end);
+    if (!out)
     {
-        dz_buffer.insert(dz_buffer.end(), chunk_headers_list[i].begin(), chunk_headers_list[i].end());
-        dz_buffer.insert(dz_buffer.end(), chunk_data_list[i].begin(), chunk_data_list[i].end());
+        throw std::runtime_error("Failed to write the DZ header to the output file");
     }
 
-    std::cout << "DZ file built successfully (" << dz_buffer.size() << " bytes)." << std::endl;
-    return dz_buffer;
+    std::cout << "DZ file built successfully (" << (dz_end - dz_start) << " bytes)." << std::endl;
+    return dz_end - dz_start;
 }
\ No newline at end of file
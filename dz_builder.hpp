@@ -5,20 +5,71 @@
 #include <filesystem>
 #include <cstdint>
 #include <mutex>
+#include <map>
+#include <iostream>
 #include "utils.hpp"
 #include "thread_pool.hpp"
+#include "executors.hpp"
 #include "shared_structure.hpp"
+#include "chunk_encoder.hpp"
+#include "file_io.hpp"
+#include "chunk_cache.hpp"
+#include "pipeline_stats.hpp"
+
+// Options controlling how DzBuilder schedules compression.
+struct DzBuildOptions {
+    // Most chunks submitted ahead of the writer; 0 uses twice the thread count.
+    size_t max_inflight_chunks = 0;
+    // Most uncompressed bytes submitted ahead of the writer; 0 means no byte limit.
+    // A single chunk larger than the limit is still processed, on its own.
+    uint64_t max_inflight_bytes = 0;
+    // The KDZ the folder was extracted from. Chunks whose image data still matches their recorded
+    // raw_fingerprint are copied from it verbatim instead of being recompressed. Null disables reuse.
+    const MappedFile* source = nullptr;
+    // The compression of the source's DZ. Its chunks are only reused when the requested codec is that
+    // compression with default settings, the way the stock firmware was built.
+    std::string source_compression;
+    // Transcoding: each chunk's raw data is decompressed from this KDZ, whose DZ uses `decode_compression`,
+    // at the chunk's file_offset instead of being read from the partition images. Null reads the images.
+    // Each chunk is checked against its recorded MD5 in the worker that decodes it.
+    const MappedFile* decode_source = nullptr;
+    std::string decode_compression;
+    // Compressed chunks shared across runs; consulted before compressing and filled after. Null disables it.
+    ChunkCache* cache = nullptr;
+};
 
 class DzBuilder {
 private:
     const json& meta;
+    DzBuildOptions options;
+    // Resolved once from dz.compression and dz.codec
+    CodecParams codec;
     std::mutex cout_mutex; // Mutex for protecting std::cout
-    std::vector<char> compress_data(const std::vector<char>& input) const;
     std::vector<char> md5_hash(const void* data, size_t size) const;
+    // Compressed form of chunks that are one repeated byte, keyed by {size, byte}. The codec is fixed
+    // per builder, so each distinct uniform chunk is compressed and hashed only once.
+    std::mutex uniform_mutex;
+    std::map<std::pair<uint32_t, uint8_t>, CompressedChunk> uniform_chunks;
+    const CompressedChunk& uniform_chunk(const char* data, uint32_t size, uint8_t value, ThreadPool& pool,
+                                         const StopToken& stop, PartitionStats* stats);
+    // Compresses one chunk and hashes the result. Each step is recorded in `stats` unless it is null.
+    void compress_chunk(const char* data, uint32_t size, ThreadPool& pool, const StopToken& stop,
+                        CompressedChunk& compressed, PartitionStats* stats);
+    // Deflates a chunk larger than codec.zlib_block_size as one zlib stream made of blocks compressed in
+    // parallel. The calling worker compresses blocks itself while idle pool workers help. Blocks not yet
+    // started when `stop` is triggered are skipped and OperationCancelled is thrown.
+    void deflate_parallel(const char* data, uint32_t size, ThreadPool& pool, const StopToken& stop,
+                          std::vector<char>& output);
 
 public:
-    explicit DzBuilder(const json& metadata) : meta(metadata["dz"]) {}
-    std::vector<char> build(const std::filesystem::path& input_dir, ThreadPool& pool);
+    explicit DzBuilder(const json& metadata, const DzBuildOptions& build_options = {})
+        : meta(metadata["dz"]), options(build_options), codec(CodecParams::from_metadata(meta)) {}
+    // Compresses every chunk and streams the DZ into `out` at its current position, in file order.
+    // The main header is patched in at the end. Returns the size of the DZ; `out` is left at its end.
+    // The first chunk that fails cancels the others, and its error is the one thrown.
+    // Partition images are read on executors.io and chunks compressed on executors.compute.
+    // Every stage is recorded in executors.stats when it is set.
+    uint64_t build(const std::filesystem::path& input_dir, Executors& executors, std::iostream& out);
 };
 
 #endif
\ No newline at end of file
@@ -15,18 +15,46 @@
 #define timegm _mkgmtime
 #endif
 
-DzHeader::DzHeader(std::ifstream& file, const KdzHeader::Record& dz_record, bool skip_verification) {
-    file.seekg(dz_record.offset);
-    
-    // Read the entire header into a raw byte buffer first.
-    std::vector<char> hdr_bytes(sizeof(DzMainHeader));
-    file.read(hdr_bytes.data(), hdr_bytes.size());
-    if (!file) {
+DzHeader::DzHeader(const MappedFile& file, const KdzHeader::Record& dz_record, bool skip_verification) {
+    if (dz_record.offset > file.size() || file.size() - dz_record.offset < sizeof(DzMainHeader)) {
+        throw std::runtime_error("Failed to read DZ header from file.");
+    }
+    // The headers are read straight out of the mapping.
+    parse(file, file.data() + dz_record.offset, dz_record.offset,
+          [&file](uint64_t pos, size_t size) { return file.slice(pos, size); }, skip_verification);
+}
+
+DzHeader::DzHeader(const MappedFile& file, const KdzHeader::Record& dz_record, bool skip_verification,
+                   const std::vector<uint8_t>& cached_headers) {
+    if (cached_headers.size() < sizeof(DzMainHeader)) {
+        throw std::runtime_error("Cached DZ headers are truncated.");
+    }
+    // The cached chunk headers are only checked against the cached chunk_hdrs_hash, so the main header they
+    // came with must be the one in the file. One 512-byte read catches a KDZ replaced under the same key.
+    if (dz_record.offset > file.size() || file.size() - dz_record.offset < sizeof(DzMainHeader)) {
         throw std::runtime_error("Failed to read DZ header from file.");
     }
+    if (std::memcmp(file.slice(dz_record.offset, sizeof(DzMainHeader)), cached_headers.data(), sizeof(DzMainHeader)) != 0) {
+        throw std::runtime_error("Cached DZ main header does not match the file.");
+    }
+    // Chunk headers follow the main header back to back in the cache, so they are handed out sequentially.
+    size_t cursor = sizeof(DzMainHeader);
+    parse(file, cached_headers.data(), dz_record.offset,
+          [&cached_headers, &cursor](uint64_t, size_t size) {
+              if (size > cached_headers.size() - cursor) {
+                  throw std::runtime_error("Cached DZ headers are truncated.");
+              }
+              const uint8_t* p = cached_headers.data() + cursor;
+              cursor += size;
+              return p;
+          },
+          skip_verification);
+}
 
+void DzHeader::parse(const MappedFile& file, const uint8_t* hdr_bytes, uint64_t dz_offset,
+                     const ChunkHeaderReader& read_chunk_header, bool skip_verification) {
     DzMainHeader hdr;
-    std::memcpy(&hdr, hdr_bytes.data(), sizeof(DzMainHeader));
+    std::memcpy(&hdr, hdr_bytes, sizeof(DzMainHeader));
 
     // Verify header CRC32 if present.
     if (hdr.header_crc != 0) {
@@ -34,7 +62,7 @@ DzHeader::DzHeader(std::ifstream& file, const KdzHeader::Record& dz_record, bool
         
         // Create a copy of the header struct for CRC calculation.
         DzMainHeader hdr_for_crc;
-        std::memcpy(&hdr_for_crc, hdr_bytes.data(), sizeof(DzMainHeader));
+        std::memcpy(&hdr_for_crc, hdr_bytes, sizeof(DzMainHeader));
 
         // Zero out the CRC field and the data_hash field with 16 null bytes.
         hdr_for_crc.header_crc = 0;
@@ -54,17 +82,6 @@ DzHeader::DzHeader(std::ifstream& file, const KdzHeader::Record& dz_record, bool
         }
     }
 
-    // Determine if data hash verification is needed.
-    bool verify_data_hash = false;
-    if (!skip_verification) {
-        for(int i=0; i<16; ++i) {
-            if (hdr.data_hash[i] != 0xff) {
-                verify_data_hash = true;
-                break;
-            }
-        }
-    }
-    
     // Assertions for header integrity, now fully implemented.
     if (hdr.magic != DZ_MAGIC) throw std::runtime_error("Invalid DZ header magic");
     if (hdr.major > 2 || hdr.minor > 1) {
@@ -168,21 +185,57 @@ DzHeader::DzHeader(std::ifstream& file, const KdzHeader::Record& dz_record, bool
     }
 
     // Finally, parse all the partition chunk headers.
-    parse_part_headers(file, verify_data_hash);
+    parse_part_headers(file, dz_offset, read_chunk_header);
+
+    // Verify the data hash unless skipped.
+    if (!skip_verification) {
+        verify_data_hash(file);
+    }
 }
 
-void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
-    MD5 chunk_hdrs_hash_ctx;
+void DzHeader::verify_data_hash(const MappedFile& file) const {
+    if (has_data_hash() && calculate_data_hash(file) != this->data_hash) {
+        throw std::runtime_error("Data hash mismatch");
+    }
+}
+
+bool DzHeader::has_data_hash() const {
+    // An all-0xff data hash means the firmware carries none.
+    return std::any_of(this->data_hash.begin(), this->data_hash.end(), [](uint8_t b){ return b != 0xff; });
+}
+
+std::vector<uint8_t> DzHeader::calculate_data_hash(const MappedFile& file, const StopToken* stop) const {
     MD5 data_hash_ctx;
 
-    if (verify_data_hash) {
-        // Add header to data hash
-        DzMainHeader hdr_for_hash;
-        file.seekg(file.tellg() - (std::streamoff)sizeof(DzMainHeader));
-        read_filestream(file, hdr_for_hash);
-        memset(hdr_for_hash.data_hash, 0xff, 16);
-        data_hash_ctx.update(reinterpret_cast<const char*>(&hdr_for_hash), sizeof(DzMainHeader));
+    // Add header to data hash
+    DzMainHeader hdr_for_hash;
+    std::memcpy(&hdr_for_hash, file.slice(this->dz_offset, sizeof(DzMainHeader)), sizeof(DzMainHeader));
+    memset(hdr_for_hash.data_hash, 0xff, 16);
+    data_hash_ctx.update(reinterpret_cast<const char*>(&hdr_for_hash), sizeof(DzMainHeader));
+
+    // Chunk headers and chunk data are laid out back to back, so the rest of the hash
+    // is one front-to-back walk over the mapping.
+    uint64_t pos = this->dz_offset + sizeof(DzMainHeader);
+    file.advise(pos, this->dz_end - pos, MappedFile::Advice::Sequential);
+    constexpr uint64_t HASH_STEP = 16 * 1048576; // 16MiB
+    while (pos < this->dz_end) {
+        if (stop) stop->throw_if_stopped();
+        uint64_t step = std::min(HASH_STEP, this->dz_end - pos);
+        data_hash_ctx.update(file.slice(pos, step), static_cast<MD5::size_type>(step));
+        // Hashed pages will not be needed again by this pass.
+        file.advise(pos, step, MappedFile::Advice::DontNeed);
+        pos += step;
     }
+
+    data_hash_ctx.finalize();
+    return data_hash_ctx.get_raw_digest();
+}
+
+void DzHeader::parse_part_headers(const MappedFile& file, uint64_t dz_offset, const ChunkHeaderReader& read_chunk_header) {
+    MD5 chunk_hdrs_hash_ctx;
+
+    this->dz_offset = dz_offset;
+    uint64_t pos = dz_offset + sizeof(DzMainHeader);
     
     uint32_t part_start_sector = 0;
     uint32_t part_sector_count = 0;
@@ -193,13 +246,13 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
         std::string part_name_str;
         Chunk chunk;
         uint32_t hw_partition;
-        std::vector<char> chunk_hdr_data;
+        size_t chunk_hdr_size = is_v0 ? sizeof(DzChunkHeaderV0) : sizeof(DzChunkHeaderV1);
+        const char* chunk_hdr_data = reinterpret_cast<const char*>(read_chunk_header(pos, chunk_hdr_size));
+        pos += chunk_hdr_size;
 
         if (is_v0) {
-            chunk_hdr_data.resize(sizeof(DzChunkHeaderV0));
-            file.read(chunk_hdr_data.data(), chunk_hdr_data.size());
             DzChunkHeaderV0 chunk_hdr;
-            std::memcpy(&chunk_hdr, chunk_hdr_data.data(), sizeof(DzChunkHeaderV0));
+            std::memcpy(&chunk_hdr, chunk_hdr_data, sizeof(DzChunkHeaderV0));
             
             if (chunk_hdr.magic != DZ_PART_MAGIC) throw std::runtime_error("Invalid part magic");
             part_name_str = decode_asciiz(chunk_hdr.part_name, 32);
@@ -207,7 +260,7 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
             chunk.data_size = chunk_hdr.decompressed_size;
             chunk.file_size = chunk_hdr.compressed_size;
             chunk.hash.assign(chunk_hdr.hash, chunk_hdr.hash + 16);
-            chunk.file_offset = file.tellg();
+            chunk.file_offset = pos;
             hw_partition = 0;
             // set defaults for V1 fields
             chunk.crc = 0; chunk.start_sector = 0; chunk.sector_count = 0;
@@ -215,10 +268,8 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
             chunk.is_sparse = false; chunk.is_ubi_image = false;
 
         } else { // V1
-            chunk_hdr_data.resize(sizeof(DzChunkHeaderV1));
-            file.read(chunk_hdr_data.data(), chunk_hdr_data.size());
             DzChunkHeaderV1 chunk_hdr;
-            std::memcpy(&chunk_hdr, chunk_hdr_data.data(), sizeof(DzChunkHeaderV1));
+            std::memcpy(&chunk_hdr, chunk_hdr_data, sizeof(DzChunkHeaderV1));
 
             if (chunk_hdr.magic != DZ_PART_MAGIC) throw std::runtime_error("Invalid part magic");
             part_name_str = decode_asciiz(chunk_hdr.part_name, 32);
@@ -233,7 +284,7 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
             chunk.unique_part_id = chunk_hdr.unique_part_id;
             chunk.is_sparse = (chunk_hdr.is_sparse != 0);
             chunk.is_ubi_image = (chunk_hdr.is_ubi_image != 0);
-            chunk.file_offset = file.tellg();
+            chunk.file_offset = pos;
 
             auto hw_it = std::find_if(parts.begin(), parts.end(), 
                                       [&](const auto& p){ return p.first == hw_partition; });
@@ -274,7 +325,7 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
             part_sector_count = (chunk.start_sector - part_start_sector) + chunk.sector_count;
         }
         
-        chunk_hdrs_hash_ctx.update(chunk_hdr_data.data(), chunk_hdr_data.size());
+        chunk_hdrs_hash_ctx.update(chunk_hdr_data, chunk_hdr_size);
             
         // Logic to populate the vector of pairs, preserving partition order.
         auto hw_it = std::find_if(this->parts.begin(), this->parts.end(),
@@ -293,34 +344,40 @@ void DzHeader::parse_part_headers(std::ifstream& file, bool verify_data_hash) {
             }
         }
         
-        // Update data hash or seek
-        if (verify_data_hash) {
-            constexpr size_t READ_CHUNK_SIZE = 1048576; // 1MiB
-            data_hash_ctx.update(chunk_hdr_data.data(), chunk_hdr_data.size());
-            std::vector<char> buffer(READ_CHUNK_SIZE);
-            uint64_t remaining = chunk.file_size;
-            while (remaining > 0) {
-                uint64_t to_read = std::min((uint64_t)READ_CHUNK_SIZE, remaining);
-                file.read(buffer.data(), to_read);
-                data_hash_ctx.update(buffer.data(), to_read);
-                remaining -= to_read;
-            }
-        } else {
-            file.seekg(chunk.file_size, std::ios_base::cur);
-        }
+        // Skip over the chunk data, making sure it is actually present in the file
+        file.slice(pos, chunk.file_size);
+        pos += chunk.file_size;
     }
+    this->dz_end = pos;
 
     chunk_hdrs_hash_ctx.finalize();
     if (chunk_hdrs_hash_ctx.hexdigest() != bytes_to_hex(this->chunk_hdrs_hash)) {
         throw std::runtime_error("Chunk headers hash mismatch");
     }
+}
 
-    if (verify_data_hash) {
-        data_hash_ctx.finalize();
-        if (data_hash_ctx.hexdigest() != bytes_to_hex(this->data_hash)) {
-            throw std::runtime_error("Data hash mismatch");
+std::vector<uint8_t> DzHeader::raw_headers(const MappedFile& file) const {
+    const uint8_t* main_hdr = file.slice(this->dz_offset, sizeof(DzMainHeader));
+    std::vector<uint8_t> headers(main_hdr, main_hdr + sizeof(DzMainHeader));
+
+    // Each chunk header sits right before its data.
+    size_t chunk_hdr_size = (this->minor == 0) ? sizeof(DzChunkHeaderV0) : sizeof(DzChunkHeaderV1);
+    std::vector<uint64_t> data_offsets;
+    for (const auto& hw_pair : parts) {
+        for (const auto& name_pair : hw_pair.second) {
+            for (const auto& chunk : name_pair.second) {
+                data_offsets.push_back(chunk.file_offset);
+            }
         }
     }
+    std::sort(data_offsets.begin(), data_offsets.end());
+
+    headers.reserve(headers.size() + data_offsets.size() * chunk_hdr_size);
+    for (uint64_t data_offset : data_offsets) {
+        const uint8_t* chunk_hdr = file.slice(data_offset - chunk_hdr_size, chunk_hdr_size);
+        headers.insert(headers.end(), chunk_hdr, chunk_hdr + chunk_hdr_size);
+    }
+    return headers;
 }
 
 void DzHeader::print_info() const {
@@ -7,8 +7,11 @@
 #include <fstream>
 #include <chrono>
 #include <optional>
+#include <functional>
 #include "kdz_parser.hpp"
 #include "shared_structure.hpp"
+#include "file_io.hpp"
+#include "stop_token.hpp"
 
 class DzHeader {
 public:
@@ -55,11 +58,39 @@ public:
 
     std::vector<std::pair<uint32_t, std::vector<std::pair<std::string, std::vector<Chunk>>>>> parts;
 
-    explicit DzHeader(std::ifstream& file, const KdzHeader::Record& dz_record, bool skip_verification);
+    explicit DzHeader(const MappedFile& file, const KdzHeader::Record& dz_record, bool skip_verification);
+    // Parses the headers from `cached_headers` (the DZ main header followed by every chunk header in file order,
+    // as returned by raw_headers) instead of reading them from the file. The cached main header must match the
+    // one in the file byte for byte, the chunk headers are still checked against its chunk_hdrs_hash, and the
+    // mapping is still used for bounds checks and the data hash.
+    DzHeader(const MappedFile& file, const KdzHeader::Record& dz_record, bool skip_verification,
+             const std::vector<uint8_t>& cached_headers);
     void print_info() const;
 
+    // The DZ main header followed by every chunk header, in file order.
+    std::vector<uint8_t> raw_headers(const MappedFile& file) const;
+
+    // Bytes covered by the data hash: the main header and every chunk header and data.
+    uint64_t dz_size() const { return dz_end - dz_offset; }
+    // True unless the stored data hash is the all-0xff "no hash" marker.
+    bool has_data_hash() const;
+    // MD5 over the DZ header and every chunk header and data, as stored in data_hash.
+    // Throws OperationCancelled if `stop` is triggered while hashing.
+    std::vector<uint8_t> calculate_data_hash(const MappedFile& file, const StopToken* stop = nullptr) const;
+    // Throws if the firmware carries a data hash and it does not match.
+    void verify_data_hash(const MappedFile& file) const;
+
 private:
-    void parse_part_headers(std::ifstream& file, bool verify_data_hash);
+    // Byte range of the DZ inside the KDZ: main header up to the end of the last chunk.
+    uint64_t dz_offset = 0;
+    uint64_t dz_end = 0;
+
+    // Returns the `size` byte chunk header that starts at file offset `pos`. Headers are requested in file order.
+    using ChunkHeaderReader = std::function<const uint8_t*(uint64_t pos, size_t size)>;
+
+    void parse(const MappedFile& file, const uint8_t* hdr_bytes, uint64_t dz_offset,
+               const ChunkHeaderReader& read_chunk_header, bool skip_verification);
+    void parse_part_headers(const MappedFile& file, uint64_t dz_offset, const ChunkHeaderReader& read_chunk_header);
 };
 
 #endif // DZ_PARSER_HPP
\ No newline at end of file
@@ -1,12 +1,23 @@
 #include "extractor.hpp"
+#include "file_io.hpp"
+#include "md5.hpp"
+#include "byte_scan.hpp"
+#include "sparse_image.hpp"
+#include "chunk_decoder.hpp"
+#include "pipeline_stats.hpp"
+#include "utils.hpp"
 #include <iostream>
 #include <filesystem> // For creating directories, requires C++17
 #include <vector>
 #include <zlib.h>
-#include <zstd.h>
 #include <map>
 #include <stdexcept>
+#include <atomic>
+#include <mutex>
 #include <future>
+#include <memory>
+#include <sstream>
+#include <functional>
 
 namespace fs = std::filesystem;
 
@@ -45,157 +56,406 @@ void extract_kdz_components(std::ifstream& file, const KdzHeader& kdz_hdr, const
     std::cout << "Done.\n" << std::endl;
 }
 
+// Granularity of zero detection; matches the sector size and the usual file system block size.
+constexpr uint64_t HOLE_BLOCK_SIZE = 4096;
+
+// Writes decompressed data at `offset`, skipping every block-aligned run of zeros.
+// Output images are created empty and chunks never overlap, so skipped ranges stay holes that read back as zeros.
+// Returns the number of bytes actually written.
+static uint64_t write_skipping_zeros(PositionalWriter& out_f, const char* data, size_t size, uint64_t offset) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t written = 0;
+    size_t run_start = 0;
+    size_t run_len = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        // Blocks are aligned to the absolute file offset so holes line up with file system blocks.
+        size_t block = std::min<uint64_t>(HOLE_BLOCK_SIZE - (offset + pos) % HOLE_BLOCK_SIZE, size - pos);
+        if (is_all_zero(p + pos, block)) {
+            if (run_len > 0) {
+                out_f.write_at(p + run_start, run_len, offset + run_start);
+                written += run_len;
+                run_len = 0;
+            }
+        } else {
+            if (run_len == 0) run_start = pos;
+            run_len += block;
+        }
+        pos += block;
+    }
+    if (run_len > 0) {
+        out_f.write_at(p + run_start, run_len, offset + run_start);
+        written += run_len;
+    }
+    return written;
+}
+
 // This is the worker function that will be executed by threads in the pool.
-// It reads compressed chunk, then decompresses it, and directly writes raw data chunks streaming.
-void decompress_and_write_chunk(
-    const std::string in_path, 
-    const std::string compression_type, 
-    uint64_t file_offset, 
-    uint32_t file_size, 
-    uint64_t out_offset,
-    std::shared_ptr<std::mutex> out_mutex,
-    std::shared_ptr<std::ofstream> out_f) 
+// It decompresses a chunk straight out of the KDZ mapping with the worker's own decoder and streams the raw data to `sink`.
+void decompress_chunk(
+    const MappedFile& kdz_map,
+    const std::string& compression_type,
+    const DzHeader::Chunk& chunk,
+    const ChunkSink& sink,
+    const StopToken* stop)
 {
-    std::ifstream file(in_path, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Thread worker failed to open input file: " + in_path);
-    }
-    
-    file.seekg(file_offset);
-
-    if (compression_type == "zlib") {
-        z_stream strm = {};
-        if (inflateInit(&strm) != Z_OK) throw std::runtime_error("inflateInit failed in worker thread");
-
-        // 1MB buffer respectively for in and out
-        std::vector<char> in_buffer(1024 * 1024);
-        std::vector<char> out_buffer(1024 * 1024);
-        uint64_t remaining_in = file_size;
-        uint64_t current_out_offset = out_offset;
-
-        while (remaining_in > 0 || strm.avail_in > 0) {
-            if (strm.avail_in == 0 && remaining_in > 0) {
-                uint32_t to_read = std::min((uint64_t)in_buffer.size(), remaining_in);
-                file.read(in_buffer.data(), to_read);
-                strm.avail_in = to_read;
-                strm.next_in = (Bytef*)in_buffer.data();
-                remaining_in -= to_read;
-            }
+    const uint8_t* in_data = kdz_map.slice(chunk.file_offset, chunk.file_size);
+    kdz_map.advise(chunk.file_offset, chunk.file_size, MappedFile::Advice::WillNeed);
 
-            strm.avail_out = out_buffer.size();
-            strm.next_out = (Bytef*)out_buffer.data();
-            
-            int ret = inflate(&strm, Z_NO_FLUSH);
-            if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR) {
-                inflateEnd(&strm);
-                throw std::runtime_error("zlib stream error in worker thread");
-            }
+    ChunkDecoder::for_this_thread().decompress(compression_type, in_data, chunk.file_size, chunk.data_size, sink, stop);
 
-            size_t have = out_buffer.size() - strm.avail_out;
-            if (have > 0) {
-                // Mutexes are only applied when writing to the disk
-				// and memory data is directly dumped to the offset location on the hard drive.
-                std::lock_guard<std::mutex> lock(*out_mutex);
-                out_f->seekp(current_out_offset);
-                out_f->write(out_buffer.data(), have);
-                current_out_offset += have;
-            }
+    // The compressed bytes are not read again.
+    kdz_map.advise(chunk.file_offset, chunk.file_size, MappedFile::Advice::DontNeed);
+}
 
-            if (ret == Z_STREAM_END) break;
-        }
-        inflateEnd(&strm);
-
-    } else if (compression_type == "zstd") {
-        ZSTD_DStream* dstream = ZSTD_createDStream();
-        if (dstream == nullptr) throw std::runtime_error("ZSTD_createDStream() failed in worker thread");
-        
-        std::vector<char> in_buffer(ZSTD_DStreamInSize());
-        std::vector<char> out_buffer(ZSTD_DStreamOutSize());
-        uint64_t remaining_in = file_size;
-        uint64_t current_out_offset = out_offset;
-
-        while (remaining_in > 0) {
-            uint32_t to_read = std::min((uint64_t)in_buffer.size(), remaining_in);
-            file.read(in_buffer.data(), to_read);
-            remaining_in -= to_read;
-
-            ZSTD_inBuffer input = { in_buffer.data(), to_read, 0 };
-            while (input.pos < input.size) {
-                ZSTD_outBuffer output = { out_buffer.data(), out_buffer.size(), 0 };
-                size_t ret = ZSTD_decompressStream(dstream, &output, &input);
-                if (ZSTD_isError(ret)) {
-                    ZSTD_freeDStream(dstream);
-                    throw std::runtime_error("ZSTD decompress error in worker thread: " + std::string(ZSTD_getErrorName(ret)));
-                }
-                
-                if (output.pos > 0) {
-                    // Likewise 
-                    std::lock_guard<std::mutex> lock(*out_mutex);
-                    out_f->seekp(current_out_offset);
-                    out_f->write(out_buffer.data(), output.pos);
-                    current_out_offset += output.pos;
-                }
-            }
+// Checks the MD5 (and, for v1 chunk headers, the CRC32) stored in a chunk header against the compressed bytes.
+// Runs inside the worker on the bytes it is about to decompress, so verification scales with the pool.
+static void verify_chunk(const MappedFile& kdz_map, const DzHeader::Chunk& chunk, bool check_crc, const std::string& part_label,
+                         PartitionStats* stats) {
+    const uint8_t* data = kdz_map.slice(chunk.file_offset, chunk.file_size);
+
+    StageTimer md5_timer(stats, Stage::Md5);
+    MD5 hasher;
+    hasher.update(data, chunk.file_size);
+    hasher.finalize();
+    std::vector<uint8_t> digest = hasher.get_raw_digest();
+    md5_timer.done(chunk.file_size, digest.size());
+    if (digest != chunk.hash) {
+        throw std::runtime_error("Chunk hash mismatch in " + part_label + ", chunk '" + chunk.name +
+                                 "' at offset " + std::to_string(chunk.file_offset) + ": expected " +
+                                 bytes_to_hex(chunk.hash) + ", got " + bytes_to_hex(digest));
+    }
+
+    if (check_crc) {
+        StageTimer crc_timer(stats, Stage::Crc);
+        uint32_t crc = crc32(0L, reinterpret_cast<const Bytef*>(data), chunk.file_size);
+        crc_timer.done(chunk.file_size, sizeof(crc));
+        if (crc != chunk.crc) {
+            std::ostringstream oss;
+            oss << "Chunk CRC mismatch in " << part_label << ", chunk '" << chunk.name << "' at offset "
+                << chunk.file_offset << ": expected 0x" << std::hex << chunk.crc << ", got 0x" << crc;
+            throw std::runtime_error(oss.str());
         }
-        ZSTD_freeDStream(dstream);
     }
 }
 
-// Writing task will be directly dispatched to the ThreadPool.
-void extract_dz_parts(const std::string& in_path, const DzHeader& dz_hdr, const std::string& out_path, ThreadPool& pool) {
+// Bookkeeping shared by all chunk tasks of one output image.
+// The task that finishes the last chunk finalizes the image.
+struct PartitionJob {
+    uint32_t hw_part;
+    std::string name;
+    fs::path path;
+    // Selected by --first: scheduled ahead of the other partitions, fsynced and announced when done.
+    bool priority = false;
+    // Exactly one of the two outputs is set, depending on the output format.
+    std::shared_ptr<PositionalWriter> out_f;
+    std::unique_ptr<SparseImageWriter> sparse_out;
+    uint64_t final_size;
+    std::atomic<size_t> remaining_chunks;
+    std::atomic<uint64_t> bytes_written{0};
+    const std::vector<DzHeader::Chunk>* chunks;
+    // RawFingerprint of every chunk, by chunk index; each task fills its own slot.
+    std::vector<uint64_t> fingerprints;
+    // Shared by every job of the extraction, triggered by the first failure.
+    const StopToken* stop = nullptr;
+    // Stage counters of this partition while --stats is collecting, null otherwise.
+    PartitionStats* stats = nullptr;
+};
+
+static void finalize_partition(PartitionJob& job, std::mutex& log_mutex) {
+    StageTimer write_timer(job.stats, Stage::Write);
+    if (job.sparse_out) {
+        job.sparse_out->finish(job.priority);
+    } else {
+        // Sparse padding
+        job.out_f->resize(job.final_size);
+        if (job.priority) job.out_f->sync();
+        job.out_f->close();
+    }
+    write_timer.done(0, 0);
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (job.sparse_out) {
+        std::cout << "  done " << job.hw_part << "." << job.name << ". image size = " << job.final_size << " bytes ("
+                  << job.sparse_out->file_size() << " bytes as sparse image)" << std::endl;
+    } else {
+        std::cout << "  done " << job.hw_part << "." << job.name << ". extracted size = " << job.final_size << " bytes ("
+                  << job.bytes_written << " bytes written, rest left sparse)" << std::endl;
+    }
+    // The image is complete and on disk, so consumers may pick it up while the rest is still extracting.
+    if (job.priority) {
+        std::cout << "  ready " << job.path.string() << std::endl;
+    }
+}
+
+// Decompresses one chunk into a raw image at `out_offset`, leaving zero blocks as holes.
+// Returns the RawFingerprint of the chunk's data.
+static uint64_t extract_chunk_raw(const MappedFile& kdz_map, const DzHeader& dz_hdr, const DzHeader::Chunk& chunk,
+                              uint64_t out_offset, PartitionJob& job) {
+    uint64_t current_out_offset = out_offset;
+    uint64_t written = 0;
+    uint64_t write_ns = 0;
+    RawFingerprint fingerprint;
+    StageTimer inflate_timer(job.stats, Stage::Inflate);
+    decompress_chunk(kdz_map, dz_hdr.compression, chunk,
+                     [&](const char* data, size_t size) {
+                         fingerprint.update(data, size);
+                         uint64_t write_started = job.stats ? stats_clock_ns() : 0;
+                         // Positional write: chunks of the same image land concurrently without a shared seek position.
+                         written += write_skipping_zeros(*job.out_f, data, size, current_out_offset);
+                         if (job.stats) write_ns += stats_clock_ns() - write_started;
+                         current_out_offset += size;
+                     }, job.stop);
+    inflate_timer.done(chunk.file_size, chunk.data_size, write_ns);
+    if (job.stats) job.stats->add(Stage::Write, chunk.data_size, written, write_ns);
+    job.bytes_written += written;
+    return fingerprint.value();
+}
+
+// Decompresses one chunk into its run of sparse image chunks and hands it to the ordered image writer.
+// Returns the RawFingerprint of the chunk's data.
+static uint64_t extract_chunk_sparse(const MappedFile& kdz_map, const DzHeader& dz_hdr, const DzHeader::Chunk& chunk,
+                                     size_t chunk_index, uint64_t out_offset, PartitionJob& job) {
+    SparseChunkEncoder encoder(out_offset / SPARSE_BLOCK_SIZE);
+    RawFingerprint fingerprint;
+    uint64_t encode_ns = 0;
+    StageTimer inflate_timer(job.stats, Stage::Inflate);
+    decompress_chunk(kdz_map, dz_hdr.compression, chunk,
+                     [&](const char* data, size_t size) {
+                         fingerprint.update(data, size);
+                         uint64_t encode_started = job.stats ? stats_clock_ns() : 0;
+                         encoder.append(data, size);
+                         if (job.stats) encode_ns += stats_clock_ns() - encode_started;
+                     }, job.stop);
+    inflate_timer.done(chunk.file_size, chunk.data_size, encode_ns);
+    // Sparse encoding counts as part of writing the image.
+    uint64_t write_started = job.stats ? stats_clock_ns() : 0;
+    encoder.finish(chunk.sector_count);
+    uint64_t encoded_size = encoder.bytes().size();
+    job.bytes_written += encoded_size;
+    job.sparse_out->add_segment(chunk_index, std::move(encoder));
+    if (job.stats) job.stats->add(Stage::Write, chunk.data_size, encoded_size, encode_ns + stats_clock_ns() - write_started);
+    return fingerprint.value();
+}
+
+static bool matches_any(const std::vector<std::string>& patterns, uint32_t hw_part, const std::string& name) {
+    std::string qualified = std::to_string(hw_part) + "." + name;
+    for (const auto& pattern : patterns) {
+        if (glob_match(pattern, name) || glob_match(pattern, qualified)) return true;
+    }
+    return false;
+}
+
+bool ExtractOptions::is_priority(uint32_t hw_part, const std::string& name) const {
+    return matches_any(first, hw_part, name);
+}
+
+bool ExtractOptions::selects_partition(uint32_t hw_part, const std::string& name) const {
+    if (!only.empty() && !matches_any(only, hw_part, name)) return false;
+    return !matches_any(exclude, hw_part, name);
+}
+
+// One chunk of a selected partition, as dispatched to the pool.
+struct ExtractTask {
+    PartitionJob* job;
+    size_t chunk_index;
+    uint64_t out_offset;    // Absolute byte offset of the chunk in the output image
+};
+
+// One global schedule: the chunks of every partition are dispatched to the compute pool up front in one bulk
+// submission per priority class, so small partitions never leave the pool idle and there is no drain at
+// partition boundaries. A bulk batch starts its tasks in index order, so chunks are decompressed in file order,
+// in step with the --single-pass hash walk.
+ChunkFingerprints extract_dz_parts(const MappedFile& kdz_map, const DzHeader& dz_hdr, const std::string& out_path,
+                                   Executors& executors, const ExtractOptions& options) {
+    std::mutex log_mutex;
+    std::vector<std::unique_ptr<PartitionJob>> jobs;
+    std::vector<ExtractTask> tasks;
+    std::vector<ExtractTask> priority_tasks;
+    StopToken stop;
+
+    // Finishing an image (writing out a sparse image, or truncating and closing a raw one) is I/O, so it is
+    // handed to the I/O executor instead of holding up a decompression worker. Priority images jump the queue.
+    std::mutex finalize_mutex;
+    std::vector<BulkHandle> finalizations;
+    auto finalize_async = [&](PartitionJob* job) {
+        std::lock_guard<std::mutex> lock(finalize_mutex);
+        finalizations.push_back(executors.io.submit_bulk(1, [job, &log_mutex](size_t) { finalize_partition(*job, log_mutex); },
+                                                         nullptr, job->priority ? TaskPriority::High : TaskPriority::Normal));
+    };
+
+    // Unselected partitions get no job, so their chunks are never read or decompressed.
+    size_t total_chunks = 0;
+    size_t selected_parts = 0;
+    for (const auto& hw_part_pair : dz_hdr.parts) {
+        for (const auto& pname_pair : hw_part_pair.second) {
+            if (!options.selects_partition(hw_part_pair.first, pname_pair.first)) continue;
+            total_chunks += pname_pair.second.size();
+            ++selected_parts;
+        }
+    }
+    if (selected_parts == 0) {
+        throw std::runtime_error("No partitions match the --only/--exclude filters");
+    }
+
+    tasks.reserve(total_chunks);
+
+    std::cout << "Scheduling " << total_chunks << " chunks..." << std::endl;
     for (const auto& hw_part_pair : dz_hdr.parts) {
         uint32_t hw_part = hw_part_pair.first;
         const auto& parts = hw_part_pair.second;
-        std::cout << "Partition " << hw_part << ":" << std::endl;
+        bool header_printed = false;
 
         for (const auto& pname_pair : parts) {
             const std::string& pname = pname_pair.first;
             const auto& chunks = pname_pair.second;
-            
-            fs::path out_file_path = fs::path(out_path) / (std::to_string(hw_part) + "." + pname + ".img");
-            std::cout << "  extracting part " << pname << "..." << std::endl;
-            
-            auto out_f = std::make_shared<std::ofstream>(out_file_path, std::ios::binary | std::ios::trunc);
-            if (!(*out_f)) {
-                throw std::runtime_error("Failed to open output file: " + out_file_path.string());
+            if (!options.selects_partition(hw_part, pname)) continue;
+
+            if (!header_printed) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "Partition " << hw_part << ":" << std::endl;
+                header_printed = true;
             }
-            auto out_mutex = std::make_shared<std::mutex>();
 
-            std::vector<std::future<void>> results;
-            results.reserve(chunks.size());
-            
+            fs::path out_file_path = fs::path(out_path) / (std::to_string(hw_part) + "." + pname + ".img");
+
             uint64_t base_sector = chunks.empty() ? 0 : chunks[0].part_start_sector;
+            uint64_t final_size = 0;
+            if (!chunks.empty()) {
+                const auto& last_chunk = chunks.back();
+                final_size = ((uint64_t)last_chunk.start_sector + last_chunk.sector_count - base_sector) * 4096;
+            }
+
+            auto job = std::make_unique<PartitionJob>();
+            job->hw_part = hw_part;
+            job->name = pname;
+            job->path = out_file_path;
+            job->priority = options.is_priority(hw_part, pname);
+            if (options.format == ImageFormat::Sparse) {
+                job->sparse_out = std::make_unique<SparseImageWriter>(out_file_path, final_size / SPARSE_BLOCK_SIZE);
+            } else {
+                job->out_f = std::make_shared<PositionalWriter>(out_file_path);
+            }
+            job->final_size = final_size;
+            job->remaining_chunks = chunks.size();
+            job->chunks = &chunks;
+            job->fingerprints.resize(chunks.size());
+            job->stop = &stop;
+            if (executors.stats) job->stats = &executors.stats->partition(hw_part, pname);
+            PartitionJob* job_ptr = job.get();
+            jobs.push_back(std::move(job));
 
-            // Push all block decompression tasks for the entire partition to ThreadPool.
-            for (const auto& chunk : chunks) {
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "  extracting part " << pname << " (" << chunks.size() << " chunks)..." << std::endl;
+            }
+
+            if (chunks.empty()) {
+                finalize_partition(*job_ptr, log_mutex);
+                continue;
+            }
+
+            for (size_t chunk_index = 0; chunk_index < chunks.size(); ++chunk_index) {
+                const auto& chunk = chunks[chunk_index];
                 // Accurately calculate the absolute byte offset of the block in the target .img file.
                 uint64_t out_offset = ((uint64_t)chunk.start_sector - base_sector) * 4096;
-                results.emplace_back(
-                    pool.enqueue(decompress_and_write_chunk, in_path, dz_hdr.compression, 
-                                 chunk.file_offset, chunk.file_size, out_offset, out_mutex, out_f)
-                );
+                (job_ptr->priority ? priority_tasks : tasks).push_back({job_ptr, chunk_index, out_offset});
             }
+        }
+    }
 
-            // Simultaneously wait for all tasks to be written and output progress logs.
-            for (size_t i = 0; i < chunks.size(); ++i) {
-                const auto& chunk = chunks[i];
-                std::cout << "    extracting chunk " << chunk.name << " (" << std::max(chunk.data_size, chunk.sector_count * 4096u) << " bytes)..." << std::endl;
-                results[i].get(); 
-            }
+    auto run_task = [&](const ExtractTask& task) {
+        PartitionJob* job = task.job;
+        const auto& chunk = (*job->chunks)[task.chunk_index];
+        if (job->stats) {
+            // The compressed bytes are faulted in up front, so the page-in time counts as reading rather than
+            // inflating. Without stats they are paged in by the hashing or the decoder as it goes.
+            StageTimer read_timer(job->stats, Stage::Read);
+            kdz_map.prefetch(chunk.file_offset, chunk.file_size);
+            read_timer.done(chunk.file_size, chunk.file_size);
+        }
+        // The fused data hash only completes after every chunk, too late for a --first image that is announced as
+        // soon as it is written. Such images are checked chunk by chunk instead, against headers that were already
+        // checked against chunk_hdrs_hash, so "ready" is only printed for verified data.
+        if (options.verify_chunks || (job->priority && options.verify_data_hash)) {
+            // Only v1 chunk headers carry a CRC.
+            verify_chunk(kdz_map, chunk, dz_hdr.minor != 0, "partition " + std::to_string(job->hw_part) + "." + job->name,
+                         job->stats);
+        }
+        if (job->sparse_out) {
+            job->fingerprints[task.chunk_index] = extract_chunk_sparse(kdz_map, dz_hdr, chunk, task.chunk_index, task.out_offset, *job);
+        } else {
+            job->fingerprints[task.chunk_index] = extract_chunk_raw(kdz_map, dz_hdr, chunk, task.out_offset, *job);
+        }
+        if (job->remaining_chunks.fetch_sub(1) == 1) {
+            finalize_async(job);
+        }
+    };
 
-            out_f->close();
+    // The first failing chunk triggers `stop`: the running chunks give up and the queued ones are skipped.
+    // Chunks of --first partitions are High priority, so every worker takes them before any other chunk.
+    if (!priority_tasks.empty()) {
+        std::cout << "  " << priority_tasks.size() << " chunks of --first partitions go first." << std::endl;
+    }
+    BulkHandle priority_extraction = executors.compute.submit_bulk(
+        priority_tasks.size(), [&](size_t i) { run_task(priority_tasks[i]); }, &stop, TaskPriority::High);
+    BulkHandle extraction = executors.compute.submit_bulk(tasks.size(), [&](size_t i) { run_task(tasks[i]); }, &stop);
 
-            // Sparse padding
-            uint64_t final_size = 0;
-            if (!chunks.empty()) {
-                const auto& last_chunk = chunks.back();
-                final_size = ((uint64_t)last_chunk.start_sector + last_chunk.sector_count - base_sector) * 4096;
-                fs::resize_file(out_file_path, final_size);
+    std::exception_ptr first_error;
+
+    // Single-pass verification: while the pool decompresses, this thread makes the one ordered walk
+    // over the DZ for the data hash. Both consumers read the same mapped pages, so each compressed
+    // byte is fetched from storage once instead of once per pass.
+    // A mismatch stops the extraction like a failed chunk does.
+    if (options.verify_data_hash && dz_hdr.has_data_hash()) {
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << "Verifying DZ data hash alongside extraction..." << std::endl;
+        }
+        try {
+            StageTimer hash_timer(whole_dz_stats(executors), Stage::Md5);
+            bool matches = dz_hdr.calculate_data_hash(kdz_map, &stop) == dz_hdr.data_hash;
+            hash_timer.done(dz_hdr.dz_size(), dz_hdr.data_hash.size());
+            if (!matches) {
+                throw std::runtime_error("Data hash mismatch (the extracted images are not trustworthy)");
             }
+        } catch (...) {
+            first_error = std::current_exception();
+            stop.request_stop(first_error);
+        }
+    }
+
+    // Every task is waited for even after a failure, since they all reference the shared mapping and jobs.
+    // Once the stop token is triggered, the chunks still queued are skipped, so this returns quickly.
+    for (BulkHandle* batch : {&priority_extraction, &extraction}) {
+        try {
+            batch->wait();
+        } catch (...) {
+            if (!first_error) first_error = std::current_exception();
+        }
+    }
+    // No new finalization is queued once every chunk task is done.
+    for (auto& finalization : finalizations) {
+        try {
+            finalization.wait();
+        } catch (...) {
+            if (!first_error) first_error = std::current_exception();
+        }
+    }
+    // Report the failure that triggered the stop, not a task that was cancelled because of it.
+    if (std::exception_ptr reason = stop.error()) first_error = reason;
+    if (first_error) std::rethrow_exception(first_error);
+
+    std::cout << "All " << jobs.size() << " partition images extracted." << std::endl << std::endl;
 
-            std::cout << "  done. extracted size = " << final_size << " bytes" << std::endl << std::endl;
+    ChunkFingerprints fingerprints;
+    for (const auto& job : jobs) {
+        for (size_t i = 0; i < job->fingerprints.size(); ++i) {
+            fingerprints[(*job->chunks)[i].file_offset] = job->fingerprints[i];
         }
     }
+    return fingerprints;
 }
 
 void extract_additional_data(std::ifstream& file, const KdzHeader& kdz_hdr, const std::string& out_path) {
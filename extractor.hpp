@@ -3,12 +3,46 @@
 
 #include "kdz_parser.hpp"
 #include "dz_parser.hpp"
-#include "thread_pool.hpp"
+#include "executors.hpp"
+#include "file_io.hpp"
 #include <string>
 #include <fstream>
+#include <vector>
+#include <map>
+
+// On-disk format of the extracted partition images.
+enum class ImageFormat {
+    Raw,    // Plain images, with zero blocks left as file system holes
+    Sparse  // Android sparse images (simg)
+};
+
+// Options controlling how DZ partitions are extracted.
+struct ExtractOptions {
+    ImageFormat format = ImageFormat::Raw;
+    // Verify the DZ data hash during extraction, in the same pass over the file that feeds the decompressors.
+    bool verify_data_hash = false;
+    // Check every chunk's MD5 and CRC inside the decompression workers.
+    bool verify_chunks = false;
+    // Partition filters. Each pattern is a wildcard matched against "<name>" and "<hw>.<name>".
+    // Empty `only` selects every partition; `exclude` is applied afterwards.
+    std::vector<std::string> only;
+    std::vector<std::string> exclude;
+    // Priority partitions, same pattern syntax. Their chunks are decompressed before any other chunk, and their
+    // images are finalized and flushed to disk first and announced as ready. With verify_data_hash, their
+    // chunks are also checked one by one, since the data hash is only known once everything is extracted.
+    std::vector<std::string> first;
+
+    bool selects_partition(uint32_t hw_part, const std::string& name) const;
+    bool is_priority(uint32_t hw_part, const std::string& name) const;
+};
+
+// RawFingerprint of every extracted chunk, keyed by the offset of the chunk's data in the KDZ.
+using ChunkFingerprints = std::map<uint64_t, uint64_t>;
 
 void extract_kdz_components(std::ifstream& file, const KdzHeader& kdz_hdr, const std::string& out_path);
-void extract_dz_parts(const std::string& in_path, const DzHeader& dz_hdr, const std::string& out_path, ThreadPool& pool);
+// Chunks are decompressed and written on executors.compute; finished images are closed on executors.io.
+ChunkFingerprints extract_dz_parts(const MappedFile& kdz_map, const DzHeader& dz_hdr, const std::string& out_path,
+                                   Executors& executors, const ExtractOptions& options);
 void extract_additional_data(std::ifstream& file, const KdzHeader& kdz_hdr, const std::string& out_path);
 
 #endif // EXTRACTOR_HPP
\ No newline at end of file
@@ -158,13 +158,32 @@ std::vector<char> KdzBuilder::build_v3_header(const std::map<std::string, Record
     return header;
 }
 
+KdzBuilder::ComponentReader KdzBuilder::folder_reader(const std::filesystem::path &components_path)
+{
+    return [components_path](const std::string &file_name) -> std::optional<std::vector<char>>
+    {
+        auto component_file = components_path / file_name;
+        if (!std::filesystem::exists(component_file))
+            return std::nullopt;
+        return read_filepath(component_file);
+    };
+}
+
 void KdzBuilder::build(const std::filesystem::path &output_path, const std::filesystem::path &input_dir,
-                       const std::vector<char> &dz_data, const std::vector<char> &sec_part_data)
+                       DzBuilder &dz_builder, Executors &executors, const std::vector<char> &sec_part_data)
+{
+    build(output_path, input_dir, folder_reader(input_dir / "components"), dz_builder, executors, sec_part_data);
+}
+
+void KdzBuilder::build(const std::filesystem::path &output_path, const std::filesystem::path &input_dir,
+                       const ComponentReader &components, DzBuilder &dz_builder, Executors &executors,
+                       const std::vector<char> &sec_part_data)
 {
 
     std::cout << "\nAssembling final KDZ file..." << std::endl;
 
-    std::ofstream f(output_path, std::ios::binary | std::ios::trunc);
+    // Opened for reading too: the DZ builder reads its chunks back to compute the data hash.
+    std::fstream f(output_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
     if (!f)
         throw std::runtime_error("Failed to create output file: " + output_path.string());
 
@@ -181,7 +200,6 @@ void KdzBuilder::build(const std::filesystem::path &output_path, const std::file
 
     // 3. Write all components and record their final offsets and sizes
     std::map<std::string, RecordInfo> final_records_info;
-    auto components_path = input_dir / "components";
 
     // Sort records by original offset to maintain file layout
     json sorted_records = meta["records"];
@@ -205,25 +223,23 @@ void KdzBuilder::build(const std::filesystem::path &output_path, const std::file
 
         if (name.find(".dz") != std::string::npos)
         {
-            f.write(dz_data.data(), dz_data.size());
-            current_size = dz_data.size();
+            current_size = dz_builder.build(input_dir, executors, f);
         }
         else
         {
-            auto component_file = components_path / name;
-            if (!std::filesystem::exists(component_file))
+            auto data = components(name);
+            if (!data.has_value())
             {
                 // Allow for empty optional records like dylib
                 if (record_meta["size"] != 0)
                 {
-                    throw std::runtime_error("ERROR: Component file not found: " + component_file.string());
+                    throw std::runtime_error("ERROR: Component file not found: " + name);
                 }
             }
             else
             {
-                auto data = read_filepath(component_file);
-                f.write(data.data(), data.size());
-                current_size = data.size();
+                f.write(data->data(), data->size());
+                current_size = data->size();
             }
         }
         final_records_info[name] = {current_offset, current_size};
@@ -243,13 +259,13 @@ void KdzBuilder::build(const std::filesystem::path &output_path, const std::file
 
         for (const auto &[key, filename] : additional_files_map)
         {
-            auto filepath = components_path / filename;
-            if (std::filesystem::exists(filepath))
+            auto component = components(filename);
+            if (component.has_value())
             {
                 // The offset for extended_mem_id is fixed. Others are placed at the current end of the file.
                 uint64_t write_offset = (key == "extended_mem_id") ? EXTENDED_MEM_ID_OFFSET : static_cast<uint64_t>(f.tellp());
 
-                auto data = read_filepath(filepath);
+                const auto &data = *component;
                 f.seekp(write_offset);
                 f.write(data.data(), data.size());
 
@@ -6,8 +6,12 @@
 #include <string>
 #include <filesystem>
 #include <cstdint>
+#include <optional>
+#include <functional>
 #include "utils.hpp"
 #include "shared_structure.hpp"
+#include "dz_builder.hpp"
+#include "executors.hpp"
 
 class KdzBuilder {
 private:
@@ -39,10 +43,21 @@ public:
     };
 #pragma pack(pop)
 
+    // Returns a component by file name: a KDZ record name, or one of the V3 additional data files
+    // ("suffix_map.dat", "sku_map.dat", "extended_sku_map.dat", "extended_mem_id.dat"). nullopt if it does not exist.
+    using ComponentReader = std::function<std::optional<std::vector<char>>(const std::string& file_name)>;
+    // Reads components from the "components" folder of an extracted firmware.
+    static ComponentReader folder_reader(const std::filesystem::path& components_path);
+
     explicit KdzBuilder(const json& metadata) : meta(metadata["kdz"]) {}
 
-    void build(const std::filesystem::path& output_path, const std::filesystem::path& input_dir, 
-               const std::vector<char>& dz_data, const std::vector<char>& sec_part_data);
+    // The DZ record is streamed into the output file by `dz_builder` while the KDZ is assembled.
+    void build(const std::filesystem::path& output_path, const std::filesystem::path& input_dir,
+               DzBuilder& dz_builder, Executors& executors, const std::vector<char>& sec_part_data);
+    // As above, with the other components supplied by `components` instead of input_dir/components.
+    void build(const std::filesystem::path& output_path, const std::filesystem::path& input_dir,
+               const ComponentReader& components, DzBuilder& dz_builder, Executors& executors,
+               const std::vector<char>& sec_part_data);
 };
 
 #endif
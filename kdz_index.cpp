@@ -0,0 +1,153 @@
+#include "kdz_index.hpp"
+#include "shared_structure.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t KDZ_INDEX_MAGIC = 0x5844494b; // "KIDX"
+constexpr uint32_t KDZ_INDEX_VERSION = 1;
+
+#pragma pack(push, 1)
+struct KdzIndexFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t kdz_size;
+    int64_t kdz_mtime;
+    uint32_t kdz_header_crc;
+    uint64_t header_region_size;
+    uint32_t header_region_stored;
+    uint32_t dz_headers_size;
+    // CRC32 over the two payloads that follow this header.
+    uint32_t payload_crc;
+};
+#pragma pack(pop)
+
+fs::path KdzIndex::path_for(const fs::path& kdz_path) {
+    fs::path index_path = kdz_path;
+    index_path += ".kdzidx";
+    return index_path;
+}
+
+KdzIndex::Key KdzIndex::key_of(const fs::path& kdz_path) {
+    Key key;
+    key.file_size = fs::file_size(kdz_path);
+    key.mtime = static_cast<int64_t>(fs::last_write_time(kdz_path).time_since_epoch().count());
+
+    // The KDZ header holds every record offset and size, so it changes whenever the layout does.
+    std::ifstream file(kdz_path, std::ios::binary);
+    std::vector<char> header(KDZV3_HDR_SIZE);
+    file.read(header.data(), header.size());
+    key.header_crc = crc32(0L, reinterpret_cast<const Bytef*>(header.data()), static_cast<uInt>(file.gcount()));
+    return key;
+}
+
+std::optional<KdzIndex> KdzIndex::load(const fs::path& kdz_path) {
+    // The index is only a cache: any failure to read it, including running out of memory, means "no index".
+    try {
+        fs::path index_path = path_for(kdz_path);
+        std::ifstream in(index_path, std::ios::binary);
+        if (!in) return std::nullopt;
+
+        KdzIndexFileHeader hdr;
+        in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+        if (!in || hdr.magic != KDZ_INDEX_MAGIC || hdr.version != KDZ_INDEX_VERSION) return std::nullopt;
+        if (hdr.header_region_stored > hdr.header_region_size || hdr.header_region_size > SP_OFFSET + SP_SIZE) {
+            return std::nullopt;
+        }
+        // The payload sizes must add up to the file, which also bounds the buffers allocated below.
+        if (fs::file_size(index_path) != sizeof(hdr) + uint64_t(hdr.header_region_stored) + hdr.dz_headers_size) {
+            return std::nullopt;
+        }
+
+        Key key = key_of(kdz_path);
+        if (hdr.kdz_size != key.file_size || hdr.kdz_mtime != key.mtime || hdr.kdz_header_crc != key.header_crc) {
+            return std::nullopt;
+        }
+
+        KdzIndex index;
+        index.header_region_size = hdr.header_region_size;
+        index.header_region.resize(hdr.header_region_stored);
+        index.dz_headers.resize(hdr.dz_headers_size);
+        in.read(index.header_region.data(), index.header_region.size());
+        in.read(reinterpret_cast<char*>(index.dz_headers.data()), index.dz_headers.size());
+        if (!in) return std::nullopt;
+
+        uint32_t crc = crc32(0L, reinterpret_cast<const Bytef*>(index.header_region.data()),
+                             static_cast<uInt>(index.header_region.size()));
+        crc = crc32(crc, index.dz_headers.data(), static_cast<uInt>(index.dz_headers.size()));
+        if (crc != hdr.payload_crc) return std::nullopt;
+
+        return index;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+KdzIndex KdzIndex::build(const MappedFile& kdz_map, const DzHeader& dz_hdr) {
+    KdzIndex index;
+    index.header_region_size = std::min<uint64_t>(kdz_map.size(), SP_OFFSET + SP_SIZE);
+
+    // The secure partition area is mostly zero padding, which does not need to be stored.
+    const char* region = reinterpret_cast<const char*>(kdz_map.data());
+    uint64_t stored = index.header_region_size;
+    while (stored > 0 && region[stored - 1] == 0) --stored;
+    index.header_region.assign(region, region + stored);
+
+    index.dz_headers = dz_hdr.raw_headers(kdz_map);
+    return index;
+}
+
+void KdzIndex::save(const fs::path& kdz_path) const {
+    Key key = key_of(kdz_path);
+
+    KdzIndexFileHeader hdr = {};
+    hdr.magic = KDZ_INDEX_MAGIC;
+    hdr.version = KDZ_INDEX_VERSION;
+    hdr.kdz_size = key.file_size;
+    hdr.kdz_mtime = key.mtime;
+    hdr.kdz_header_crc = key.header_crc;
+    hdr.header_region_size = header_region_size;
+    hdr.header_region_stored = static_cast<uint32_t>(header_region.size());
+    hdr.dz_headers_size = static_cast<uint32_t>(dz_headers.size());
+    hdr.payload_crc = crc32(0L, reinterpret_cast<const Bytef*>(header_region.data()),
+                            static_cast<uInt>(header_region.size()));
+    hdr.payload_crc = crc32(hdr.payload_crc, dz_headers.data(), static_cast<uInt>(dz_headers.size()));
+
+    // Written under a temporary name and renamed, so readers never see a half-written index. The name is unique
+    // per thread and process, so processes indexing the same KDZ at once never write into the same file; the
+    // last rename wins and both wrote the same index.
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    fs::path index_path = path_for(kdz_path);
+    fs::path tmp_path = index_path;
+    tmp_path += "." + std::to_string(rng()) + ".tmp";
+
+    std::error_code ec;
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Failed to create index file: " + tmp_path.string());
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        out.write(header_region.data(), header_region.size());
+        out.write(reinterpret_cast<const char*>(dz_headers.data()), dz_headers.size());
+        if (!out) {
+            out.close();
+            fs::remove(tmp_path, ec);
+            throw std::runtime_error("Failed to write index file: " + tmp_path.string());
+        }
+    }
+    fs::rename(tmp_path, index_path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        throw std::runtime_error("Failed to replace index file: " + index_path.string());
+    }
+}
+
+std::istringstream KdzIndex::header_stream() const {
+    std::string region(header_region.begin(), header_region.end());
+    region.resize(header_region_size, '\0');
+    return std::istringstream(region, std::ios::in | std::ios::binary);
+}
@@ -0,0 +1,47 @@
+#ifndef KDZ_INDEX_HPP
+#define KDZ_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <optional>
+#include <sstream>
+#include <filesystem>
+#include "file_io.hpp"
+#include "dz_parser.hpp"
+
+// Sidecar index (<kdz>.kdzidx) holding every header of a KDZ file: the KDZ header and secure partition
+// region plus the DZ main header and all chunk headers. Repeated inspection parses from this one small
+// file instead of touching headers spread across the whole firmware.
+// The index is keyed by the KDZ file size, mtime and the CRC32 of its KDZ header.
+class KdzIndex {
+public:
+    // Start of the file up to the end of the secure partition, with trailing zero bytes trimmed.
+    std::vector<char> header_region;
+    uint64_t header_region_size = 0;
+    // DzHeader::raw_headers() of the DZ record.
+    std::vector<uint8_t> dz_headers;
+
+    static std::filesystem::path path_for(const std::filesystem::path& kdz_path);
+
+    // Loads the index of `kdz_path`. Returns nullopt if there is none, it is damaged or its key
+    // no longer matches the KDZ file.
+    static std::optional<KdzIndex> load(const std::filesystem::path& kdz_path);
+    // Collects the index of a KDZ whose DZ has just been parsed from `kdz_map`.
+    static KdzIndex build(const MappedFile& kdz_map, const DzHeader& dz_hdr);
+    // Writes the index next to `kdz_path`, replacing any previous one atomically.
+    void save(const std::filesystem::path& kdz_path) const;
+
+    // A stream over the header region, as KdzHeader and SecurePartition::parse expect to read it from the KDZ.
+    std::istringstream header_stream() const;
+
+private:
+    struct Key {
+        uint64_t file_size;
+        int64_t mtime;
+        uint32_t header_crc;
+    };
+    static Key key_of(const std::filesystem::path& kdz_path);
+};
+
+#endif // KDZ_INDEX_HPP
@@ -6,7 +6,7 @@
 #include <cstring>
 #include <algorithm>
 
-KdzHeader::KdzHeader(std::ifstream& file) {
+KdzHeader::KdzHeader(std::istream& file) {
     file.seekg(0);
     std::vector<char> hdr_data(KDZV3_HDR_SIZE);
     file.read(hdr_data.data(), KDZV3_HDR_SIZE);
@@ -137,7 +137,7 @@ void KdzHeader::parse_v3_header(const std::vector<char>& data) {
     this->extended_mem_id = {EXTENDED_MEM_ID_OFFSET, ext_mem_id_size};
 }
 
-void KdzHeader::print_info(std::ifstream& file) const {
+void KdzHeader::print_info(std::istream& file) const {
     auto read_asciiz_data = [&](uint64_t offset, uint32_t size) -> std::string {
         if (size == 0) return "";
         std::vector<char> buffer(size);
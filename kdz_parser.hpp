@@ -34,8 +34,8 @@ public:
     AdditionalRecord sku_map;
     AdditionalRecord extended_sku_map;
 
-    explicit KdzHeader(std::ifstream& file);
-    void print_info(std::ifstream& file) const;
+    explicit KdzHeader(std::istream& file);
+    void print_info(std::istream& file) const;
 
 private:
     void parse_v1_header(const std::vector<char>& data);
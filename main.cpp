@@ -7,6 +7,8 @@
 #include <thread>
 #include <algorithm>
 #include <stdexcept>
+#include <sstream>
+#include <cstring>
 
 // --- Headers required for unpacking ---
 #include "kdz_parser.hpp"
@@ -14,11 +16,20 @@
 #include "dz_parser.hpp"
 #include "extractor.hpp"
 #include "metadata_generator.hpp"
+#include "kdz_index.hpp"
+#include "utils.hpp"
 
 // --- Headers required for repacking ---
 #include "secure_partition_builder.hpp"
 #include "kdz_builder.hpp"
 #include "dz_builder.hpp"
+#include "chunk_encoder.hpp"
+#include "chunk_cache.hpp"
+
+// --- Headers required for transcoding ---
+#include "transcoder.hpp"
+
+#include "pipeline_stats.hpp"
 
 namespace fs = std::filesystem;
 
@@ -27,21 +38,192 @@ void printUsage(const char* progName) {
     std::cerr << "Usage: " << progName << " <command> [options]" << std::endl << std::endl;
     std::cerr << "Commands:" << std::endl;
     std::cerr << "  extract    Extract a KDZ file to a folder." << std::endl;
-    std::cerr << "  repack     Repack an extracted folder into a KDZ file." << std::endl << std::endl;
+    std::cerr << "  repack     Repack an extracted folder into a KDZ file." << std::endl;
+    std::cerr << "  transcode  Convert a KDZ to another chunk codec without extracting it." << std::endl << std::endl;
     std::cerr << "Options for 'extract':" << std::endl;
-    std::cerr << "  " << progName << " extract <kdz_file> [-d <path>] [--no-verify]" << std::endl;
+    std::cerr << "  " << progName << " extract <kdz_file> [-d <path>] [--no-verify] [--single-pass] [--verify-chunks]" << std::endl;
+    std::cerr << "          [--format raw|sparse] [--only <globs>] [--exclude <globs>] [--first <globs>] [--index-cache]" << std::endl;
     std::cerr << "    <kdz_file>           Path to the input KDZ firmware file." << std::endl;
     std::cerr << "    -d, --dest <path>    The directory to extract files to." << std::endl;
     std::cerr << "                         (If not specified, only header info will be printed)." << std::endl;
-    std::cerr << "    --no-verify          Skip DZ data hash verification for faster startup." << std::endl << std::endl;
+    std::cerr << "    --no-verify          Skip DZ data hash verification for faster startup." << std::endl;
+    std::cerr << "    --single-pass        Verify the DZ data hash while extracting instead of in a separate" << std::endl;
+    std::cerr << "                         pass first, so the firmware is read only once. A mismatch fails" << std::endl;
+    std::cerr << "                         the command and cancels any chunks still being extracted." << std::endl;
+    std::cerr << "    --verify-chunks      Check each chunk's MD5 and CRC in the decompression workers and" << std::endl;
+    std::cerr << "                         name the corrupt chunk on failure. Works with --no-verify." << std::endl;
+    std::cerr << "    --format <fmt>       Image format: 'raw' (default) or 'sparse' for Android sparse images." << std::endl;
+    std::cerr << "                         Sparse images must be expanded (simg2img) before repacking." << std::endl;
+    std::cerr << "    --only <globs>       Extract only partitions matching one of the comma-separated wildcard" << std::endl;
+    std::cerr << "                         patterns, e.g. 'boot,vendor_boot' or '0.abl*'. Patterns match" << std::endl;
+    std::cerr << "                         '<name>' or '<hw>.<name>'. Other chunks are not read." << std::endl;
+    std::cerr << "    --exclude <globs>    Skip partitions matching any of the patterns." << std::endl;
+    std::cerr << "                         With either filter, the selected chunks are verified one by one" << std::endl;
+    std::cerr << "                         instead of the whole DZ data hash." << std::endl;
+    std::cerr << "    --first <globs>      Extract matching partitions ahead of the others: their chunks are" << std::endl;
+    std::cerr << "                         decompressed first, and each image is flushed to disk and reported" << std::endl;
+    std::cerr << "                         with a 'ready <path>' line as soon as it is complete." << std::endl;
+    std::cerr << "    --index-cache        Read all headers from the '<kdz_file>.kdzidx' sidecar when it is" << std::endl;
+    std::cerr << "                         up to date, and create or refresh it otherwise." << std::endl << std::endl;
     std::cerr << "Options for 'repack':" << std::endl;
-    std::cerr << "  " << progName << " repack <input_dir> <output_file>" << std::endl;
+    std::cerr << "  " << progName << " repack <input_dir> <output_file> [--max-inflight <n>] [--max-inflight-bytes <size>]" << std::endl;
+    std::cerr << "          [--level <n>] [--zstd-long] [--zstd-window-log <n>] [--zstd-strategy <name>] [--zlib-block-size <size>]" << std::endl;
+    std::cerr << "          [--source <kdz_file>] [--no-reuse] [--chunk-cache <dir>] [--chunk-cache-size <size>]" << std::endl;
     std::cerr << "    <input_dir>          Path to the directory containing extracted files and metadata.json." << std::endl;
-    std::cerr << "    <output_file>        Path for the new output KDZ file." << std::endl << std::endl;
+    std::cerr << "    <output_file>        Path for the new output KDZ file." << std::endl;
+    std::cerr << "    --max-inflight <n>   Most chunks being compressed or waiting to be written at once" << std::endl;
+    std::cerr << "                         (default: twice the --threads count)." << std::endl;
+    std::cerr << "    --max-inflight-bytes <size>" << std::endl;
+    std::cerr << "                         Most uncompressed bytes in flight at once, e.g. 512M or 1G" << std::endl;
+    std::cerr << "                         (default: no limit). Bounds repack memory use." << std::endl;
+    std::cerr << "    --level <n>          Compression level (zlib 0-9, zstd up to 22; default: codec default)." << std::endl;
+    std::cerr << "    --zstd-long          Enable zstd long distance matching (--no-zstd-long overrides dz.codec)." << std::endl;
+    std::cerr << "    --zstd-window-log <n>" << std::endl;
+    std::cerr << "                         zstd window size as a power of two." << std::endl;
+    std::cerr << "    --zstd-strategy <name>" << std::endl;
+    std::cerr << "                         zstd match finder: fast, dfast, greedy, lazy, lazy2, btlazy2," << std::endl;
+    std::cerr << "                         btopt, btultra or btultra2." << std::endl;
+    std::cerr << "    --zlib-block-size <size>" << std::endl;
+    std::cerr << "                         Deflate zlib chunks larger than this in parallel blocks of this size" << std::endl;
+    std::cerr << "                         (at least 64K), joined into one zlib stream. Default: off." << std::endl;
+    std::cerr << "                         Codec options override dz.codec in metadata.json for this run only." << std::endl;
+    std::cerr << "    --source <kdz_file>  The KDZ the folder was extracted from (default: the one recorded in" << std::endl;
+    std::cerr << "                         metadata.json, if it is still there). Chunks whose image data is" << std::endl;
+    std::cerr << "                         unchanged are copied from it instead of being recompressed." << std::endl;
+    std::cerr << "                         Not used when dz.codec is set." << std::endl;
+    std::cerr << "    --no-reuse           Recompress every chunk." << std::endl;
+    std::cerr << "    --chunk-cache <dir>  Look compressed chunks up in this directory before compressing them, and" << std::endl;
+    std::cerr << "                         add new ones. Safe to share between concurrent kdz-tool processes." << std::endl;
+    std::cerr << "    --chunk-cache-size <size>" << std::endl;
+    std::cerr << "                         Least recently used entries are evicted beyond this size, e.g. 20G" << std::endl;
+    std::cerr << "                         (default: 8G; 0 means no limit)." << std::endl << std::endl;
+    std::cerr << "Options for 'transcode':" << std::endl;
+    std::cerr << "  " << progName << " transcode <kdz_file> <output_file> --to zlib|zstd" << std::endl;
+    std::cerr << "          [--level <n>] [--zstd-long] [--zstd-window-log <n>] [--zstd-strategy <name>] [--zlib-block-size <size>]" << std::endl;
+    std::cerr << "          [--max-inflight <n>] [--max-inflight-bytes <size>] [--chunk-cache <dir>] [--chunk-cache-size <size>]" << std::endl;
+    std::cerr << "    --to <codec>         Codec of the output DZ chunks." << std::endl;
+    std::cerr << "                         The other options work as for 'repack'. Every input chunk is checked" << std::endl;
+    std::cerr << "                         against its MD5 as it is decoded." << std::endl << std::endl;
     std::cerr << "General Options:" << std::endl;
+    std::cerr << "  --threads <n>        Threads for decompression, compression and hashing (default: the CPUs" << std::endl;
+    std::cerr << "                       this process may use, after affinity and cgroup CPU quota)." << std::endl;
+    std::cerr << "  --io-threads <n>     Threads for reading and writing files (default: half the usable CPUs," << std::endl;
+    std::cerr << "                       between 2 and 8). Both take at most 1024." << std::endl;
+    std::cerr << "  --stats              Print task latency, queue depth and per-partition bytes and time of" << std::endl;
+    std::cerr << "                       each stage (read, inflate/deflate, md5, crc, write) when done." << std::endl;
+    std::cerr << "  --stats-json <file>  Write the same statistics, with the full queue depth series and" << std::endl;
+    std::cerr << "                       latency histograms, to <file> as JSON." << std::endl;
     std::cerr << "  -h, --help           Show this help message and exit." << std::endl;
 }
 
+// Options shared by 'repack' and 'transcode'.
+struct BuildArgs {
+    DzBuildOptions build;
+    // Codec overrides, merged into dz.codec
+    json codec_overrides = json::object();
+    std::optional<std::string> chunk_cache_dir;
+    uint64_t chunk_cache_size = 8ull << 30;
+};
+
+// Parses the build option at argv[i], advancing `i` past its value.
+// Returns 1 if it was one, 0 if `arg` is not a build option and -1 after reporting an error.
+static int parse_build_option(int argc, char* argv[], int& i, BuildArgs& args) {
+    std::string arg = argv[i];
+    if (arg == "--zstd-long" || arg == "--no-zstd-long") {
+        args.codec_overrides["zstd_long"] = arg == "--zstd-long";
+        return 1;
+    }
+    if (arg != "--max-inflight" && arg != "--max-inflight-bytes" && arg != "--chunk-cache" &&
+        arg != "--chunk-cache-size" && arg != "--level" && arg != "--zstd-window-log" && arg != "--zstd-strategy" &&
+        arg != "--zlib-block-size") {
+        return 0;
+    }
+    if (i + 1 >= argc) {
+        std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+        printUsage(argv[0]);
+        return -1;
+    }
+    std::string value = argv[++i];
+    try {
+        if (arg == "--max-inflight") {
+            args.build.max_inflight_chunks = static_cast<size_t>(parse_count(value));
+        } else if (arg == "--max-inflight-bytes") {
+            args.build.max_inflight_bytes = parse_byte_size(value);
+        } else if (arg == "--chunk-cache") {
+            args.chunk_cache_dir = value;
+        } else if (arg == "--chunk-cache-size") {
+            args.chunk_cache_size = parse_byte_size(value);
+        } else if (arg == "--level") {
+            args.codec_overrides["level"] = parse_int(value);
+        } else if (arg == "--zstd-window-log") {
+            args.codec_overrides["zstd_window_log"] = parse_int(value);
+        } else if (arg == "--zlib-block-size") {
+            uint64_t block_size = parse_byte_size(value);
+            if (block_size > UINT32_MAX) throw std::out_of_range(value);
+            args.codec_overrides["zlib_block_size"] = static_cast<uint32_t>(block_size);
+        } else {
+            args.codec_overrides["zstd_strategy"] = value;
+        }
+    } catch (const std::exception&) {
+        std::cerr << "Error: Invalid value '" << value << "' for " << arg << "." << std::endl;
+        return -1;
+    }
+    return 1;
+}
+
+// Records the codec settings a build used in <output_file>.build.json, since the KDZ itself only names the
+// compression. The input is never modified. A failure only warns: the KDZ is already complete.
+static void write_build_record(const fs::path& output_file, const std::string& input, const CodecParams& codec) {
+    json record = {
+        {"input", input},
+        {"output", output_file.filename().string()},
+        {"compression", codec.compression},
+        {"codec", codec.to_json()}
+    };
+    fs::path record_path = output_file;
+    record_path += ".build.json";
+    std::ofstream out(record_path);
+    out << record.dump(4) << std::endl;
+    if (!out) {
+        std::cerr << "Warning: could not write build record " << record_path.string() << std::endl;
+        return;
+    }
+    std::cout << "Codec settings (" << codec.describe() << ") recorded in " << record_path.string() << std::endl;
+}
+
+// Each command matches its options first, so an argument left over that starts with '-' is a mistyped or
+// unsupported option rather than a file name.
+static bool is_unknown_option(const std::string& arg) {
+    return arg.size() > 1 && arg[0] == '-';
+}
+
+static int report_unknown_option(const std::string& arg, const std::string& command, const char* prog_name) {
+    std::cerr << "Error: Unknown option '" << arg << "' for " << command << "." << std::endl;
+    printUsage(prog_name);
+    return 1;
+}
+
+// Whether `path` is the KDZ described by the "source" object of metadata.json: the same size and the same DZ
+// data hash and chunk header hash. Reused chunks are still checked one by one against their recorded MD5/CRC.
+static bool is_extraction_source(const std::string& path, const json& source_meta) {
+    if (!source_meta.contains("data_hash") || !source_meta.contains("chunk_hdrs_hash")) return false;
+    try {
+        if (!fs::exists(path) || fs::file_size(path) != source_meta["size"].get<uint64_t>()) return false;
+        std::ifstream in_file(path, std::ios::binary);
+        KdzHeader kdz_header(in_file);
+        for (const auto& record : kdz_header.records) {
+            if (record.name.size() < 3 || record.name.substr(record.name.size() - 3) != ".dz") continue;
+            MappedFile map(path);
+            DzMainHeader dz_main{};
+            std::memcpy(&dz_main, map.slice(record.offset, sizeof(dz_main)), sizeof(dz_main));
+            return bytes_to_hex(dz_main.data_hash, sizeof(dz_main.data_hash)) == source_meta["data_hash"] &&
+                   bytes_to_hex(dz_main.chunk_hdrs_hash, sizeof(dz_main.chunk_hdrs_hash)) == source_meta["chunk_hdrs_hash"];
+        }
+    } catch (const std::exception&) {
+    }
+    return false;
+}
+
 int main(int argc, char* argv[]) {
     // Handle help options in priority
     for (int i = 1; i < argc; ++i) {
@@ -52,26 +234,119 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // --threads, --io-threads and the stats options apply to every command, so they are taken out before the
+    // command's own options.
+    size_t compute_threads = 0;
+    size_t io_threads = 0;
+    bool print_stats = false;
+    std::optional<std::string> stats_json_path;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i > 0 && arg == "--stats") {
+            print_stats = true;
+            continue;
+        }
+        if (i > 0 && arg == "--stats-json") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            stats_json_path = argv[++i];
+            continue;
+        }
+        if (i > 0 && (arg == "--threads" || arg == "--io-threads")) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            std::string value = argv[++i];
+            uint64_t count = 0;
+            try {
+                count = parse_count(value);
+            } catch (const std::exception&) {
+                std::cerr << "Error: Invalid value '" << value << "' for " << arg << "." << std::endl;
+                return 1;
+            }
+            if (count == 0 || count > Executors::MAX_THREADS) {
+                std::cerr << "Error: " << arg << " must be between 1 and " << Executors::MAX_THREADS << ", got "
+                          << value << "." << std::endl;
+                return 1;
+            }
+            (arg == "--threads" ? compute_threads : io_threads) = static_cast<size_t>(count);
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    argc = static_cast<int>(args.size());
+    args.push_back(nullptr);
+    argv = args.data();
+
     if (argc < 2) {
-        std::cerr << "Error: No command specified. Use 'extract' or 'repack'." << std::endl;
+        std::cerr << "Error: No command specified. Use 'extract', 'repack' or 'transcode'." << std::endl;
         printUsage(argv[0]);
         return 1;
     }
 
     try {
         std::string command = argv[1];
-        size_t num_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
-        ThreadPool pool(num_threads);
+        // Declared before the executors so it outlives their pool workers, which record into it until joined.
+        std::optional<PipelineStats> stats;
+        Executors executors(compute_threads, io_threads);
+        if (print_stats || stats_json_path.has_value()) stats.emplace(executors);
+        std::ostringstream thread_summary;
+        thread_summary << executors.compute.size() << " compute threads and " << executors.io.size() << " I/O threads";
         
         if (command == "extract") {
             std::string file_path;
             std::optional<std::string> extract_path;
             bool skip_verification = false;
+            bool single_pass = false;
+            bool verify_chunks = false;
+            ImageFormat image_format = ImageFormat::Raw;
+            std::vector<std::string> only_patterns;
+            std::vector<std::string> exclude_patterns;
+            std::vector<std::string> first_patterns;
+            bool use_index_cache = false;
 
             for (int i = 2; i < argc; ++i) {
                 std::string arg = argv[i];
                 if (arg == "--no-verify") {
                     skip_verification = true;
+                } else if (arg == "--single-pass") {
+                    single_pass = true;
+                } else if (arg == "--verify-chunks") {
+                    verify_chunks = true;
+                } else if (arg == "--index-cache") {
+                    use_index_cache = true;
+                } else if (arg == "--format") {
+                    if (i + 1 >= argc) {
+                        std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                        printUsage(argv[0]);
+                        return 1;
+                    }
+                    std::string fmt = argv[++i];
+                    if (fmt == "raw") {
+                        image_format = ImageFormat::Raw;
+                    } else if (fmt == "sparse") {
+                        image_format = ImageFormat::Sparse;
+                    } else {
+                        std::cerr << "Error: Unknown image format '" << fmt << "'. Use 'raw' or 'sparse'." << std::endl;
+                        printUsage(argv[0]);
+                        return 1;
+                    }
+                } else if (arg == "--only" || arg == "--exclude" || arg == "--first") {
+                    if (i + 1 >= argc) {
+                        std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                        printUsage(argv[0]);
+                        return 1;
+                    }
+                    auto& patterns = (arg == "--only") ? only_patterns : (arg == "--exclude") ? exclude_patterns : first_patterns;
+                    for (const auto& pattern : split_string(argv[++i], ',')) {
+                        if (!pattern.empty()) patterns.push_back(pattern);
+                    }
                 } else if (arg == "-d" || arg == "--dest") {
                     if (i + 1 < argc) {
                         extract_path = argv[++i];
@@ -80,6 +355,8 @@ int main(int argc, char* argv[]) {
                         printUsage(argv[0]);
                         return 1;
                     }
+                } else if (is_unknown_option(arg)) {
+                    return report_unknown_option(arg, command, argv[0]);
                 } else {
                     if (!file_path.empty()) {
                         std::cerr << "Error: Multiple input files specified for extract. Only one is allowed." << std::endl;
@@ -101,11 +378,26 @@ int main(int argc, char* argv[]) {
                 throw std::runtime_error("Cannot open file " + file_path);
             }
 
+            // The DZ parser and the decompression workers read the KDZ through one shared mapping.
+            MappedFile kdz_map(file_path);
+
+            // A valid index cache supplies every header from one small sidecar file.
+            std::optional<KdzIndex> index;
+            std::istringstream index_stream;
+            if (use_index_cache) {
+                index = KdzIndex::load(file_path);
+                if (index.has_value()) {
+                    std::cout << "Using index cache " << KdzIndex::path_for(file_path).string() << "\n" << std::endl;
+                    index_stream = index->header_stream();
+                }
+            }
+            std::istream& header_in = index.has_value() ? static_cast<std::istream&>(index_stream) : in_file;
+
             // 1. Parse all headers and store the object
-            KdzHeader kdz_header(in_file);
+            KdzHeader kdz_header(header_in);
             kdz_header.print_info(in_file);
 
-            std::optional<SecurePartition> sec_part = SecurePartition::parse(in_file);
+            std::optional<SecurePartition> sec_part = SecurePartition::parse(header_in);
             if (sec_part.has_value()) {
                 sec_part->print_info();
             } else {
@@ -123,7 +415,46 @@ int main(int argc, char* argv[]) {
                 throw std::runtime_error("No DZ record in KDZ file");
             }
 
-            DzHeader dz_hdr(in_file, *dz_record_ptr, skip_verification);
+            // The data hash covers the whole DZ, so hashing it would read every chunk. When only some partitions
+            // are extracted, the selected chunks are checked individually against their headers instead.
+            bool partial_extract = extract_path.has_value() && (!only_patterns.empty() || !exclude_patterns.empty());
+            if (partial_extract && !skip_verification) {
+                std::cout << "Partition filter given: verifying the selected chunks instead of the whole DZ data hash.\n" << std::endl;
+                verify_chunks = true;
+            }
+
+            // In single-pass mode the data hash is checked by extract_dz_parts instead of up front.
+            bool fused_verification = single_pass && extract_path.has_value() && !skip_verification && !partial_extract;
+            bool verify_up_front = !(skip_verification || fused_verification || partial_extract);
+
+            std::optional<DzHeader> dz_hdr_opt;
+            if (index.has_value()) {
+                // The cached main header is compared with the file's and the cached chunk headers with its
+                // chunk_hdrs_hash; if either check fails, parse the file instead.
+                try {
+                    dz_hdr_opt.emplace(kdz_map, *dz_record_ptr, true, index->dz_headers);
+                } catch (const std::exception& e) {
+                    std::cout << "Index cache rejected (" << e.what() << "), reading headers from the KDZ.\n" << std::endl;
+                    index.reset();
+                }
+            }
+            if (!dz_hdr_opt.has_value()) {
+                dz_hdr_opt.emplace(kdz_map, *dz_record_ptr, true);
+                if (use_index_cache) {
+                    try {
+                        KdzIndex::build(kdz_map, *dz_hdr_opt).save(file_path);
+                        std::cout << "Saved index cache " << KdzIndex::path_for(file_path).string() << "\n" << std::endl;
+                    } catch (const std::exception& e) {
+                        std::cerr << "Warning: could not save index cache: " << e.what() << std::endl;
+                    }
+                }
+            }
+            const DzHeader& dz_hdr = *dz_hdr_opt;
+            if (verify_up_front) {
+                StageTimer hash_timer(whole_dz_stats(executors), Stage::Md5);
+                dz_hdr.verify_data_hash(kdz_map);
+                hash_timer.done(dz_hdr.dz_size(), dz_hdr.data_hash.size());
+            }
             dz_hdr.print_info();
 
             // 2. If unpacking is requested, extract all embedded objects and their metadata.
@@ -133,15 +464,27 @@ int main(int argc, char* argv[]) {
                 // Unpacking DLLs and other components
                 extract_kdz_components(in_file, kdz_header, *extract_path);
                 
-                // Use thread pool to unpack DZ partitions
-                std::cout << "Initializing thread pool with " << num_threads << " threads for extraction." << std::endl << std::endl;
-                extract_dz_parts(file_path, dz_hdr, *extract_path, pool);
+                // Use the executors to unpack DZ partitions
+                std::cout << "Using " << thread_summary.str() << " for extraction." << std::endl << std::endl;
+                ExtractOptions extract_options;
+                extract_options.verify_data_hash = fused_verification;
+                extract_options.verify_chunks = verify_chunks;
+                extract_options.format = image_format;
+                extract_options.only = only_patterns;
+                extract_options.exclude = exclude_patterns;
+                extract_options.first = first_patterns;
+                ChunkFingerprints fingerprints = extract_dz_parts(kdz_map, dz_hdr, *extract_path, executors, extract_options);
 
                 // Unpacking V3's additional information
                 extract_additional_data(in_file, kdz_header, *extract_path);
 
-                // 3. Generate and store metadata.json
-                generate_metadata(*extract_path, kdz_header, sec_part, dz_hdr);
+                // 3. Generate and store metadata.json (always for the whole firmware, filtered or not)
+                MetadataExtras extras;
+                extras.image_format = image_format == ImageFormat::Sparse ? "sparse" : "raw";
+                extras.source_path = fs::absolute(file_path).string();
+                extras.source_size = kdz_map.size();
+                extras.raw_fingerprints = std::move(fingerprints);
+                generate_metadata(*extract_path, kdz_header, sec_part, dz_hdr, extras);
             
             } else {
                  // If not unpacked, only print detailed information
@@ -161,14 +504,44 @@ int main(int argc, char* argv[]) {
             }
 
         } else if (command == "repack") {
-            if (argc != 4) {
+            std::vector<std::string> positional;
+            BuildArgs build_args;
+            DzBuildOptions& build_options = build_args.build;
+            json& codec_overrides = build_args.codec_overrides;
+            std::optional<std::string> source_path;
+            bool reuse_source = true;
+
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                int parsed = parse_build_option(argc, argv, i, build_args);
+                if (parsed < 0) {
+                    return 1;
+                } else if (parsed > 0) {
+                    continue;
+                } else if (arg == "--source") {
+                    if (i + 1 >= argc) {
+                        std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                        printUsage(argv[0]);
+                        return 1;
+                    }
+                    source_path = argv[++i];
+                } else if (arg == "--no-reuse") {
+                    reuse_source = false;
+                } else if (is_unknown_option(arg)) {
+                    return report_unknown_option(arg, command, argv[0]);
+                } else {
+                    positional.push_back(arg);
+                }
+            }
+
+            if (positional.size() != 2) {
                 std::cerr << "Error: Invalid number of arguments for repack command." << std::endl;
-                std::cerr << "Usage: " << argv[0] << " repack <input_dir> <output_file>" << std::endl;
+                std::cerr << "Usage: " << argv[0] << " repack <input_dir> <output_file> [options]" << std::endl;
                 return 1;
             }
 
-            fs::path input_dir(argv[2]);
-            fs::path output_file(argv[3]);
+            fs::path input_dir(positional[0]);
+            fs::path output_file(positional[1]);
 
             auto metadata_path = input_dir / "metadata.json";
             if (!fs::exists(metadata_path)) {
@@ -178,23 +551,130 @@ int main(int argc, char* argv[]) {
             std::ifstream meta_file(metadata_path);
             json metadata = json::parse(meta_file);
 
+            if (metadata.value("image_format", "raw") != "raw") {
+                throw std::runtime_error("ERROR: The images in '" + input_dir.string() + "' were extracted as " +
+                                         metadata["image_format"].get<std::string>() +
+                                         " images. Convert them to raw images (e.g. with simg2img) and set "
+                                         "\"image_format\" to \"raw\" in metadata.json before repacking.");
+            }
+
+            // Codec options given on the command line apply to this build only: they are merged into the
+            // in-memory metadata, and the folder's metadata.json is never rewritten. The settings in effect are
+            // recorded next to the output instead.
+            if (!codec_overrides.empty()) {
+                json& dz_meta = metadata["dz"];
+                if (!dz_meta.contains("codec")) dz_meta["codec"] = json::object();
+                dz_meta["codec"].update(codec_overrides);
+            }
+            // Rejects invalid combinations before anything is written.
+            const CodecParams build_codec = CodecParams::from_metadata(metadata["dz"]);
+
+            // The chunk offsets and fingerprints in metadata.json only describe the KDZ they were extracted from,
+            // which is recognised by its size and DZ header hashes. An explicit source that does not match is an error.
+            std::optional<MappedFile> source_map;
+            if (reuse_source && (source_path.has_value() || metadata.contains("source"))) {
+                if (!metadata.contains("source")) {
+                    throw std::runtime_error("ERROR: metadata.json does not record chunk fingerprints; extract the folder again "
+                                             "to repack it incrementally.");
+                }
+                const json& source_meta = metadata["source"];
+                std::string path = source_path.value_or(source_meta["path"].get<std::string>());
+                if (!is_extraction_source(path, source_meta)) {
+                    if (source_path.has_value()) {
+                        throw std::runtime_error("ERROR: '" + path + "' is not the KDZ '" + input_dir.string() +
+                                                 "' was extracted from (or metadata.json is too old to identify it; extract the folder again).");
+                    }
+                    std::cout << "Source KDZ " << path << " not found or changed; recompressing every chunk.\n" << std::endl;
+                } else {
+                    source_map.emplace(path);
+                    build_options.source = &*source_map;
+                    build_options.source_compression = source_meta.value("compression", std::string());
+                    std::cout << "Reusing unchanged chunks from " << path << "\n" << std::endl;
+                }
+            }
+
+            std::optional<ChunkCache> chunk_cache;
+            if (build_args.chunk_cache_dir.has_value()) {
+                chunk_cache.emplace(*build_args.chunk_cache_dir, build_args.chunk_cache_size);
+                build_options.cache = &*chunk_cache;
+                std::cout << "Using chunk cache " << *build_args.chunk_cache_dir << "\n" << std::endl;
+            }
+
             // 1. Create Secure Partition data (if it exists)
             SecurePartitionBuilder sec_part_builder(metadata);
 
-            // 2. Use the thread pool to create DZ archive data
-            std::cout << "Using " << num_threads << " threads for parallel processing." << std::endl;
-            DzBuilder dz_builder(metadata);
-            auto dz_binary_data = dz_builder.build(input_dir, pool);
-
-            // 3. Creating the final KDZ profile
+            // 2. Create the final KDZ; the DZ archive is compressed by the executors and streamed into it
+            std::cout << "Using " << thread_summary.str() << " for parallel processing." << std::endl;
+            DzBuilder dz_builder(metadata, build_options);
             KdzBuilder kdz_builder(metadata);
-            kdz_builder.build(output_file, input_dir, dz_binary_data, sec_part_builder.data);
+            kdz_builder.build(output_file, input_dir, dz_builder, executors, sec_part_builder.data);
+            write_build_record(output_file, input_dir.string(), build_codec);
+        } else if (command == "transcode") {
+            std::vector<std::string> positional;
+            BuildArgs build_args;
+            TranscodeOptions transcode_options;
+
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                int parsed = parse_build_option(argc, argv, i, build_args);
+                if (parsed < 0) {
+                    return 1;
+                } else if (parsed > 0) {
+                    continue;
+                } else if (arg == "--to") {
+                    if (i + 1 >= argc) {
+                        std::cerr << "Error: " << arg << " option requires an argument." << std::endl;
+                        printUsage(argv[0]);
+                        return 1;
+                    }
+                    transcode_options.compression = argv[++i];
+                } else if (is_unknown_option(arg)) {
+                    return report_unknown_option(arg, command, argv[0]);
+                } else {
+                    positional.push_back(arg);
+                }
+            }
+
+            if (positional.size() != 2) {
+                std::cerr << "Error: Invalid number of arguments for transcode command." << std::endl;
+                std::cerr << "Usage: " << argv[0] << " transcode <kdz_file> <output_file> --to zlib|zstd [options]" << std::endl;
+                return 1;
+            }
+            if (transcode_options.compression != "zlib" && transcode_options.compression != "zstd") {
+                std::cerr << "Error: --to must be 'zlib' or 'zstd'." << std::endl;
+                return 1;
+            }
+
+            std::optional<ChunkCache> chunk_cache;
+            if (build_args.chunk_cache_dir.has_value()) {
+                chunk_cache.emplace(*build_args.chunk_cache_dir, build_args.chunk_cache_size);
+                build_args.build.cache = &*chunk_cache;
+            }
+            transcode_options.codec = build_args.codec_overrides;
+            transcode_options.build = build_args.build;
+
+            std::cout << "Using " << thread_summary.str() << " for parallel processing." << std::endl;
+            transcode_kdz(positional[0], positional[1], transcode_options, executors);
+            json target_meta = {{"compression", transcode_options.compression}, {"codec", transcode_options.codec}};
+            write_build_record(positional[1], positional[0], CodecParams::from_metadata(target_meta));
         } else {
-            std::cerr << "Error: Unknown command '" << command << "'. Use 'extract' or 'repack'." << std::endl;
+            std::cerr << "Error: Unknown command '" << command << "'. Use 'extract', 'repack' or 'transcode'." << std::endl;
             printUsage(argv[0]);
             return 1;
         }
 
+        if (stats_json_path.has_value()) {
+            std::ofstream stats_file(*stats_json_path);
+            if (!stats_file) {
+                throw std::runtime_error("Cannot open stats file " + *stats_json_path);
+            }
+            stats_file << stats->to_json().dump(2) << std::endl;
+            std::cout << "Stats saved to " << *stats_json_path << std::endl;
+        }
+        if (print_stats) {
+            stats->print(std::cout);
+        }
+
     } catch (const std::exception& e) {
         std::cerr << "An error occurred: " << e.what() << std::endl;
         return 1;
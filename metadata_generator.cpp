@@ -3,16 +3,15 @@
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <filesystem>
 
-void generate_metadata(
-    const std::string& out_path,
+json build_metadata(
     const KdzHeader& kdz_hdr,
     const std::optional<SecurePartition>& sec_part,
-    const DzHeader& dz_hdr
+    const DzHeader& dz_hdr,
+    const MetadataExtras& extras
 ) {
-    std::cout << "Generating metadata.json..." << std::endl;
-
     json metadata;
 
     // KDZ metadata
@@ -104,7 +103,7 @@ void generate_metadata(
         for (const auto& name_pair : hw_pair.second) {
             json chunks_json = json::array();
             for (const auto& c : name_pair.second) {
-                chunks_json.push_back({
+                json chunk_json = {
                     {"name", c.name},
                     {"data_size", c.data_size},
                     {"file_offset", c.file_offset},
@@ -117,7 +116,14 @@ void generate_metadata(
                     {"unique_part_id", c.unique_part_id},
                     {"is_sparse", c.is_sparse},
                     {"is_ubi_image", c.is_ubi_image}
-                });
+                };
+                auto fingerprint = extras.raw_fingerprints.find(c.file_offset);
+                if (fingerprint != extras.raw_fingerprints.end()) {
+                    std::ostringstream oss;
+                    oss << std::hex << std::setw(16) << std::setfill('0') << fingerprint->second;
+                    chunk_json["raw_fingerprint"] = oss.str();
+                }
+                chunks_json.push_back(chunk_json);
             }
             pname_json[name_pair.first] = chunks_json;
         }
@@ -126,6 +132,33 @@ void generate_metadata(
     dz_json["parts"] = dz_parts_json;
     metadata["dz"] = dz_json;
 
+    // Only recorded when the images cannot be repacked as they are.
+    if (extras.image_format != "raw") {
+        metadata["image_format"] = extras.image_format;
+    }
+    if (!extras.source_path.empty()) {
+        // The DZ header hashes identify the source beyond its size; repack compares them before reusing chunks.
+        metadata["source"] = {
+            {"path", extras.source_path},
+            {"size", extras.source_size},
+            {"data_hash", bytes_to_hex(dz_hdr.data_hash)},
+            {"chunk_hdrs_hash", bytes_to_hex(dz_hdr.chunk_hdrs_hash)},
+            {"compression", dz_hdr.compression}
+        };
+    }
+    return metadata;
+}
+
+void generate_metadata(
+    const std::string& out_path,
+    const KdzHeader& kdz_hdr,
+    const std::optional<SecurePartition>& sec_part,
+    const DzHeader& dz_hdr,
+    const MetadataExtras& extras
+) {
+    std::cout << "Generating metadata.json..." << std::endl;
+    json metadata = build_metadata(kdz_hdr, sec_part, dz_hdr, extras);
+
     std::filesystem::path metadata_path = std::filesystem::path(out_path) / "metadata.json";
     std::ofstream out_f(metadata_path);
     out_f << metadata.dump(4);
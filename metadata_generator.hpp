@@ -4,13 +4,35 @@
 #include "kdz_parser.hpp"
 #include "secure_partition_parser.hpp"
 #include "dz_parser.hpp"
+#include "utils.hpp"
 #include <string>
+#include <map>
+#include <cstdint>
+
+// Extraction details recorded next to the parsed headers.
+struct MetadataExtras {
+    std::string image_format = "raw";
+    // The KDZ the folder was extracted from, so repack can reuse its compressed chunks.
+    std::string source_path;
+    uint64_t source_size = 0;
+    // RawFingerprint of each extracted chunk, keyed by the offset of its data in the source KDZ.
+    std::map<uint64_t, uint64_t> raw_fingerprints;
+};
+
+// The metadata.json document describing a parsed KDZ.
+json build_metadata(
+    const KdzHeader& kdz_hdr,
+    const std::optional<SecurePartition>& sec_part,
+    const DzHeader& dz_hdr,
+    const MetadataExtras& extras = {}
+);
 
 void generate_metadata(
     const std::string& out_path,
     const KdzHeader& kdz_hdr,
     const std::optional<SecurePartition>& sec_part,
-    const DzHeader& dz_hdr
+    const DzHeader& dz_hdr,
+    const MetadataExtras& extras = {}
 );
 
 #endif // METADATA_GENERATOR_HPP
\ No newline at end of file
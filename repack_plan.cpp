@@ -0,0 +1,60 @@
+#include "repack_plan.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+RepackPlan RepackPlan::from_metadata(const json& dz_meta, const fs::path& input_dir) {
+    RepackPlan plan;
+    plan.chunks.reserve(dz_meta["part_count"].get<size_t>());
+
+    for (const auto& [hw_part_str, parts] : dz_meta["parts"].items()) {
+        uint32_t hw_part = static_cast<uint32_t>(std::stoul(hw_part_str));
+        for (const auto& [pname, chunks] : parts.items()) {
+            fs::path image_path = input_dir / (std::to_string(hw_part) + "." + pname + ".img");
+            uint32_t partition = static_cast<uint32_t>(plan.partitions.size());
+            plan.partitions.push_back({hw_part, pname, image_path, fs::exists(image_path)});
+            auto part_name = encode_asciiz(pname, sizeof(RepackChunk::part_name));
+
+            for (const auto& chunk_meta : chunks) {
+                RepackChunk chunk{};
+                chunk.partition = partition;
+                chunk.data_size = chunk_meta["data_size"];
+                chunk.start_sector = chunk_meta["start_sector"];
+                chunk.sector_count = chunk_meta["sector_count"];
+                chunk.part_start_sector = chunk_meta["part_start_sector"];
+                chunk.unique_part_id = chunk_meta["unique_part_id"];
+                chunk.is_sparse = chunk_meta["is_sparse"];
+                chunk.is_ubi_image = chunk_meta["is_ubi_image"];
+                chunk.image_offset = (static_cast<uint64_t>(chunk.start_sector) - chunk.part_start_sector) * 4096;
+                chunk.file_offset = chunk_meta.value("file_offset", uint64_t(0));
+                chunk.file_size = chunk_meta.value("file_size", 0u);
+                if (chunk_meta.contains("hash")) {
+                    std::vector<uint8_t> hash = unhexlify(chunk_meta["hash"].get<std::string>());
+                    if (hash.size() == sizeof(chunk.hash)) {
+                        chunk.has_hash = true;
+                        std::memcpy(chunk.hash, hash.data(), sizeof(chunk.hash));
+                        chunk.crc = chunk_meta.value("crc", 0u);
+                    }
+                }
+                if (chunk_meta.contains("raw_fingerprint")) {
+                    chunk.has_fingerprint = true;
+                    chunk.raw_fingerprint = std::stoull(chunk_meta["raw_fingerprint"].get<std::string>(), nullptr, 16);
+                }
+                std::memcpy(chunk.part_name, part_name.data(), sizeof(chunk.part_name));
+                auto chunk_name = encode_asciiz(chunk_meta["name"], sizeof(chunk.chunk_name));
+                std::memcpy(chunk.chunk_name, chunk_name.data(), sizeof(chunk.chunk_name));
+                plan.chunks.push_back(chunk);
+            }
+        }
+    }
+    return plan;
+}
+
+std::vector<const RepackPartition*> RepackPlan::missing_images() const {
+    std::vector<const RepackPartition*> missing;
+    for (const auto& partition : partitions) {
+        if (!partition.has_image) missing.push_back(&partition);
+    }
+    return missing;
+}
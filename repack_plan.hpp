@@ -0,0 +1,56 @@
+#ifndef REPACK_PLAN_HPP
+#define REPACK_PLAN_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "utils.hpp"
+
+// One partition image read by the repack workers.
+struct RepackPartition {
+    uint32_t hw_part;
+    std::string name;
+    std::filesystem::path image_path;
+    // False when the image is not in the folder, e.g. after an --only/--exclude extraction. The chunks of such a
+    // partition can only be copied from the source KDZ.
+    bool has_image;
+};
+
+// Everything needed to build one DZ chunk, resolved from metadata.json before any task runs.
+// Plain data, so the workers never touch the JSON and the plan is one contiguous array.
+struct RepackChunk {
+    uint32_t partition;         // Index into RepackPlan::partitions
+    uint32_t data_size;
+    uint64_t image_offset;      // Start of the chunk's data in the partition image
+    uint32_t start_sector;
+    uint32_t sector_count;
+    uint32_t part_start_sector;
+    uint32_t unique_part_id;
+    bool is_sparse;
+    bool is_ubi_image;
+    // Where the chunk was stored in the KDZ the folder was extracted from, and its RawFingerprint.
+    bool has_fingerprint;
+    uint64_t raw_fingerprint;
+    uint64_t file_offset;
+    uint32_t file_size;
+    // MD5 and CRC32 of the compressed data in the source KDZ, checked before any of it is copied.
+    bool has_hash;
+    uint8_t hash[16];
+    uint32_t crc;
+    // Already encoded for the chunk header
+    char part_name[32];
+    char chunk_name[64];
+};
+
+struct RepackPlan {
+    std::vector<RepackPartition> partitions;
+    std::vector<RepackChunk> chunks;    // In DZ file order
+
+    // Parses dz.parts once, noting which partition images exist in `input_dir`.
+    static RepackPlan from_metadata(const json& dz_meta, const std::filesystem::path& input_dir);
+    // The partitions whose image is missing from the folder.
+    std::vector<const RepackPartition*> missing_images() const;
+};
+
+#endif // REPACK_PLAN_HPP
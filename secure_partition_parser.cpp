@@ -6,7 +6,7 @@
 #include <cstring>
 #include <algorithm>
 
-std::optional<SecurePartition> SecurePartition::parse(std::ifstream& file) {
+std::optional<SecurePartition> SecurePartition::parse(std::istream& file) {
     try {
         file.seekg(SP_OFFSET);
         std::vector<char> data(SP_SIZE);
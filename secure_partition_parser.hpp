@@ -29,7 +29,7 @@ public:
     // The structure is: vector<pair<hw_id, vector<pair<partition_name, vector<Part_info>>>>>
     std::vector<std::pair<uint8_t, std::vector<std::pair<std::string, std::vector<Part>>>>> parts;
 
-    static std::optional<SecurePartition> parse(std::ifstream& file);
+    static std::optional<SecurePartition> parse(std::istream& file);
     void print_info() const;
 
 private:
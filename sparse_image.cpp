@@ -0,0 +1,185 @@
+#include "sparse_image.hpp"
+#include "byte_scan.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <limits>
+#include <algorithm>
+
+// Caps RAW chunks so total_sz always fits its 32-bit field.
+constexpr uint32_t MAX_RAW_RUN_BLOCKS = 16384;
+
+static void append_chunk_header(std::vector<char>& out, uint16_t type, uint32_t blocks, uint32_t total_sz) {
+    SparseChunkHeader hdr{};
+    hdr.chunk_type = type;
+    hdr.chunk_sz = blocks;
+    hdr.total_sz = total_sz;
+    out.insert(out.end(), reinterpret_cast<const char*>(&hdr), reinterpret_cast<const char*>(&hdr) + sizeof(hdr));
+}
+
+static uint32_t append_dont_care(std::vector<char>& out, uint64_t blocks) {
+    uint32_t chunks = 0;
+    while (blocks > 0) {
+        uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(blocks, std::numeric_limits<uint32_t>::max()));
+        append_chunk_header(out, SPARSE_CHUNK_DONT_CARE, n, sizeof(SparseChunkHeader));
+        blocks -= n;
+        ++chunks;
+    }
+    return chunks;
+}
+
+SparseChunkEncoder::SparseChunkEncoder(uint64_t start_block) : first_block(start_block) {}
+
+void SparseChunkEncoder::append(const char* data, size_t size) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+    // Complete a block left over from the previous call first.
+    if (!partial.empty()) {
+        size_t take = std::min<size_t>(SPARSE_BLOCK_SIZE - partial.size(), size);
+        partial.insert(partial.end(), p, p + take);
+        p += take;
+        size -= take;
+        if (partial.size() < SPARSE_BLOCK_SIZE) return;
+        add_block(partial.data());
+        partial.clear();
+    }
+    while (size >= SPARSE_BLOCK_SIZE) {
+        add_block(p);
+        p += SPARSE_BLOCK_SIZE;
+        size -= SPARSE_BLOCK_SIZE;
+    }
+    partial.assign(p, p + size);
+}
+
+void SparseChunkEncoder::finish(uint64_t block_span) {
+    if (!partial.empty()) {
+        partial.resize(SPARSE_BLOCK_SIZE, 0);
+        add_block(partial.data());
+        partial.clear();
+    }
+    flush_run();
+    if (block_span > blocks) {
+        chunks += append_dont_care(encoded, block_span - blocks);
+        blocks = block_span;
+    }
+}
+
+void SparseChunkEncoder::add_block(const uint8_t* block) {
+    uint32_t fill = 0;
+    bool uniform = is_uniform_u32(block, SPARSE_BLOCK_SIZE, fill);
+    uint16_t type = uniform ? SPARSE_CHUNK_FILL : SPARSE_CHUNK_RAW;
+
+    bool extends_run = run_blocks > 0 && run_type == type && (!uniform || run_fill == fill) &&
+                       (type != SPARSE_CHUNK_RAW || run_blocks < MAX_RAW_RUN_BLOCKS);
+    if (!extends_run) {
+        flush_run();
+        run_type = type;
+        run_fill = fill;
+        if (type == SPARSE_CHUNK_RAW) {
+            // RAW data follows its header directly; the header is patched when the run ends.
+            run_header_pos = encoded.size();
+            append_chunk_header(encoded, SPARSE_CHUNK_RAW, 0, 0);
+        }
+    }
+    if (type == SPARSE_CHUNK_RAW) {
+        encoded.insert(encoded.end(), reinterpret_cast<const char*>(block), reinterpret_cast<const char*>(block) + SPARSE_BLOCK_SIZE);
+    }
+    ++run_blocks;
+    ++blocks;
+}
+
+void SparseChunkEncoder::flush_run() {
+    if (run_blocks == 0) return;
+    if (run_type == SPARSE_CHUNK_RAW) {
+        SparseChunkHeader hdr{};
+        hdr.chunk_type = SPARSE_CHUNK_RAW;
+        hdr.chunk_sz = run_blocks;
+        hdr.total_sz = sizeof(SparseChunkHeader) + run_blocks * SPARSE_BLOCK_SIZE;
+        std::memcpy(encoded.data() + run_header_pos, &hdr, sizeof(hdr));
+    } else {
+        append_chunk_header(encoded, SPARSE_CHUNK_FILL, run_blocks, sizeof(SparseChunkHeader) + sizeof(uint32_t));
+        encoded.insert(encoded.end(), reinterpret_cast<const char*>(&run_fill), reinterpret_cast<const char*>(&run_fill) + sizeof(run_fill));
+    }
+    ++chunks;
+    run_blocks = 0;
+}
+
+SparseImageWriter::SparseImageWriter(const std::filesystem::path& path, uint64_t total_blocks)
+    : out(path), total_blocks(total_blocks) {
+    if (total_blocks > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Image too large for a sparse image: " + path.string());
+    }
+}
+
+void SparseImageWriter::add_segment(size_t index, SparseChunkEncoder segment) {
+    struct Placement {
+        std::vector<char> gap;
+        SparseChunkEncoder segment;
+        uint64_t offset;
+    };
+    std::vector<Placement> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace(index, std::move(segment));
+
+        for (auto it = pending.find(next_index); it != pending.end(); it = pending.find(next_index)) {
+            SparseChunkEncoder& seg = it->second;
+            if (seg.start_block() < current_block) {
+                throw std::runtime_error("Overlapping chunks cannot be written as a sparse image: " + out.path().string());
+            }
+            Placement placement{{}, std::move(seg), file_offset};
+            total_chunks += append_dont_care(placement.gap, placement.segment.start_block() - current_block);
+            total_chunks += placement.segment.chunk_count();
+            current_block = placement.segment.start_block() + placement.segment.block_count();
+            file_offset += placement.gap.size() + placement.segment.bytes().size();
+
+            ready.push_back(std::move(placement));
+            pending.erase(it);
+            ++next_index;
+        }
+    }
+
+    for (const auto& placement : ready) {
+        uint64_t offset = placement.offset;
+        if (!placement.gap.empty()) {
+            out.write_at(placement.gap.data(), placement.gap.size(), offset);
+            offset += placement.gap.size();
+        }
+        const auto& bytes = placement.segment.bytes();
+        if (!bytes.empty()) {
+            out.write_at(bytes.data(), bytes.size(), offset);
+        }
+    }
+}
+
+void SparseImageWriter::finish(bool sync) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending.empty()) {
+        throw std::runtime_error("Sparse image finished with missing chunks: " + out.path().string());
+    }
+    if (current_block > total_blocks) {
+        throw std::runtime_error("Chunks extend past the end of the sparse image: " + out.path().string());
+    }
+
+    std::vector<char> tail;
+    total_chunks += append_dont_care(tail, total_blocks - current_block);
+    if (!tail.empty()) {
+        out.write_at(tail.data(), tail.size(), file_offset);
+        file_offset += tail.size();
+    }
+    current_block = total_blocks;
+
+    SparseImageHeader hdr{};
+    hdr.magic = SPARSE_HEADER_MAGIC;
+    hdr.major_version = 1;
+    hdr.minor_version = 0;
+    hdr.file_hdr_sz = sizeof(SparseImageHeader);
+    hdr.chunk_hdr_sz = sizeof(SparseChunkHeader);
+    hdr.blk_sz = SPARSE_BLOCK_SIZE;
+    hdr.total_blks = static_cast<uint32_t>(total_blocks);
+    hdr.total_chunks = total_chunks;
+    hdr.image_checksum = 0;
+    out.write_at(&hdr, sizeof(hdr), 0);
+    if (sync) out.sync();
+    out.close();
+}
@@ -0,0 +1,74 @@
+#ifndef SPARSE_IMAGE_HPP
+#define SPARSE_IMAGE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <filesystem>
+#include "file_io.hpp"
+#include "shared_structure.hpp"
+
+// Encodes the decompressed data of one DZ chunk as a run of Android sparse image chunks.
+// Blocks holding one repeated 32-bit word become FILL chunks and everything else RAW;
+// sectors the DZ chunk spans without data become DONT_CARE.
+class SparseChunkEncoder {
+public:
+    explicit SparseChunkEncoder(uint64_t start_block);
+
+    // Feeds the next piece of decompressed data.
+    void append(const char* data, size_t size);
+    // Zero pads a trailing partial block and covers the rest of `block_span` with DONT_CARE.
+    void finish(uint64_t block_span);
+
+    uint64_t start_block() const { return first_block; }
+    uint64_t block_count() const { return blocks; }
+    uint32_t chunk_count() const { return chunks; }
+    const std::vector<char>& bytes() const { return encoded; }
+
+private:
+    void add_block(const uint8_t* block);
+    void flush_run();
+
+    uint64_t first_block;
+    uint64_t blocks = 0;
+    uint32_t chunks = 0;
+    std::vector<char> encoded;
+    std::vector<uint8_t> partial;
+
+    // The run of equal-typed blocks currently being built.
+    uint16_t run_type = 0;
+    uint32_t run_fill = 0;
+    uint32_t run_blocks = 0;
+    size_t run_header_pos = 0;
+};
+
+// Assembles a sparse image from per-chunk segments that may finish in any order.
+// Segments are laid out in index order; the gaps between them become DONT_CARE.
+class SparseImageWriter {
+public:
+    SparseImageWriter(const std::filesystem::path& path, uint64_t total_blocks);
+
+    // Hands over the segment for chunk `index`. Thread-safe; the file space for a segment is
+    // reserved once every earlier segment has arrived, and the data is written outside the lock.
+    void add_segment(size_t index, SparseChunkEncoder segment);
+    // Covers the tail with DONT_CARE, writes the file header and closes the file, after flushing it to
+    // stable storage if `sync` is set.
+    void finish(bool sync = false);
+
+    uint64_t file_size() const { return file_offset; }
+
+private:
+    PositionalWriter out;
+    uint64_t total_blocks;
+
+    std::mutex mutex;
+    size_t next_index = 0;
+    std::map<size_t, SparseChunkEncoder> pending;
+    uint64_t current_block = 0;
+    uint64_t file_offset = sizeof(SparseImageHeader);
+    uint32_t total_chunks = 0;
+};
+
+#endif // SPARSE_IMAGE_HPP
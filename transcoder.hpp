@@ -0,0 +1,25 @@
+#ifndef TRANSCODER_HPP
+#define TRANSCODER_HPP
+
+#include <string>
+#include <filesystem>
+#include "utils.hpp"
+#include "executors.hpp"
+#include "dz_builder.hpp"
+
+// Options for converting a KDZ to another chunk codec.
+struct TranscodeOptions {
+    std::string compression;            // Target codec: "zlib" or "zstd"
+    json codec = json::object();        // dz.codec settings for the target codec
+    DzBuildOptions build;
+};
+
+// Rewrites `in_path` as `out_path` with every DZ chunk recompressed for the target codec. Chunks are paged in on the
+// I/O executor, then checked against their MD5, decompressed straight from the source mapping and recompressed on the
+// compute executor; chunk headers, the DZ header and the KDZ records are rebuilt around them. Together with the chunk
+// header hash checked while parsing, that verifies everything the DZ data hash covers, without a separate pass.
+// No partition image or component file is written.
+void transcode_kdz(const std::filesystem::path& in_path, const std::filesystem::path& out_path,
+                   const TranscodeOptions& options, Executors& executors);
+
+#endif // TRANSCODER_HPP